@@ -0,0 +1,135 @@
+#include <cmath>
+#include <random>
+
+enum access_pattern
+{
+    PATTERN_RANDOM,     // uniform shuffle, every chunk once
+    PATTERN_SEQUENTIAL, // ascending, every chunk once
+    PATTERN_REVERSE,    // descending, every chunk once
+    PATTERN_STRIDED,    // pattern_stride chunks apart, wrapping, every chunk once
+    PATTERN_ZIPF,       // Zipf ranked draws, hot chunks are reused and stay cached
+    PATTERN_MIXED,      // sequential stream with mixed_hot_pct% Zipf hot-set draws
+    PATTERN_MAX,
+};
+
+static const char *pattern_names[PATTERN_MAX] = {"random", "seq", "reverse", "strided", "zipf", "mixed"};
+static enum access_pattern access_pattern = PATTERN_RANDOM;
+static unsigned long pattern_stride = 16;
+static double zipf_skew = 0.99;
+static unsigned int mixed_hot_pct = 20;
+
+static int parse_access_pattern(const char *name)
+{
+    for (int i = 0; i < PATTERN_MAX; i++)
+    {
+        if (!strcmp(name, pattern_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Patterns that touch every chunk exactly once leave the whole destination
+ * written, the others only the chunks they drew.
+ */
+static bool pattern_is_permutation(enum access_pattern pattern)
+{
+    return pattern <= PATTERN_STRIDED;
+}
+
+/**
+ * Sample Zipf ranks over n items by binary search in the precomputed CDF.
+ * Ranks are mapped through a random permutation so the hot chunks are
+ * scattered over the buffer rather than packed at its start.
+ */
+struct zipf_sampler
+{
+    std::vector<double> cdf;
+    std::vector<unsigned long> rank_to_chunk;
+
+    zipf_sampler(unsigned long n, double skew, std::mt19937_64 &rng)
+        : cdf(n), rank_to_chunk(n)
+    {
+        double sum = 0;
+
+        for (unsigned long k = 0; k < n; k++)
+        {
+            sum += 1.0 / pow((double)(k + 1), skew);
+            cdf[k] = sum;
+            rank_to_chunk[k] = k;
+        }
+        for (unsigned long k = 0; k < n; k++)
+            cdf[k] /= sum;
+        std::shuffle(rank_to_chunk.begin(), rank_to_chunk.end(), rng);
+    }
+
+    unsigned long operator()(std::mt19937_64 &rng)
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t k = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+
+        return rank_to_chunk[std::min(k, cdf.size() - 1)];
+    }
+};
+
+/**
+ * Fill order with n chunk indices in [0, n) following pattern. Fewer than
+ * two chunks have a single order.
+ */
+static void generate_pattern(enum access_pattern pattern, unsigned long *order, unsigned long n,
+                             std::mt19937_64 &rng)
+{
+    unsigned long i, j, r;
+
+    if (n < 2)
+    {
+        if (n == 1)
+            order[0] = 0;
+        return;
+    }
+    switch (pattern)
+    {
+    case PATTERN_SEQUENTIAL:
+        for (i = 0; i < n; i++)
+            order[i] = i;
+        break;
+    case PATTERN_REVERSE:
+        for (i = 0; i < n; i++)
+            order[i] = n - 1 - i;
+        break;
+    case PATTERN_STRIDED:
+        for (r = 0, i = 0; r < pattern_stride && i < n; r++)
+        {
+            for (j = r; j < n; j += pattern_stride)
+                order[i++] = j;
+        }
+        break;
+    case PATTERN_ZIPF:
+    {
+        zipf_sampler zipf(n, zipf_skew, rng);
+
+        for (i = 0; i < n; i++)
+            order[i] = zipf(rng);
+        break;
+    }
+    case PATTERN_MIXED:
+    {
+        zipf_sampler zipf(n, zipf_skew, rng);
+        std::uniform_int_distribution<unsigned int> pct(0, 99);
+        unsigned long stream = 0;
+
+        for (i = 0; i < n; i++)
+            order[i] = pct(rng) < mixed_hot_pct ? zipf(rng) : stream++;
+        break;
+    }
+    default:
+        for (i = 0; i < n; i++)
+            order[i] = i;
+        for (i = n - 1; i > 0; i--)
+        {
+            unsigned long k = std::uniform_int_distribution<unsigned long>(0, i)(rng);
+            std::swap(order[i], order[k]);
+        }
+        break;
+    }
+}
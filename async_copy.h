@@ -0,0 +1,298 @@
+#include <atomic>
+#include <coroutine>
+
+/**
+ * Asynchronous copies: start a copy, keep working, learn later that it
+ * landed.
+ *
+ * An async_copy is the handle of one copy in flight, on DSA (descriptors
+ * on the striped WQs) or on a copy thread of the cpu backend for hosts
+ * without DSA. async_copy_test() checks it without blocking and
+ * async_copy_wait() blocks. Coroutines co_await copy_async(...) instead:
+ * they suspend until async_poll(), called from the application's loop
+ * between units of its own work, finds their copy complete and resumes
+ * them. One async_poll() call checks every suspended copy's completion
+ * records in a single pass.
+ *
+ * Handles carry the completion records the device writes, so they need
+ * 32-byte alignment; coroutine frames do not guarantee it, allocate
+ * handles with async_copy_alloc() and hand them to the coroutines.
+ */
+#define ASYNC_MAX_DESC 64 // a longer DSA copy has its tail done by the cpu at start
+
+// descriptors of copies not yet reaped, per WQ; past a WQ's size the cpu copies
+static unsigned long async_inflight[DSA_MAX_WQS];
+
+enum async_backend
+{
+    ASYNC_DSA,
+    ASYNC_CPU,
+};
+
+static const char *async_backend_names[] = {"dsa", "cpu"};
+
+struct async_copy
+{
+    struct dsa_hw_desc desc[ASYNC_MAX_DESC] __attribute__((aligned(64)));
+    struct dsa_completion_record comp[ASYNC_MAX_DESC] __attribute__((aligned(32)));
+    struct dsa_wq_info *sub[ASYNC_MAX_DESC];
+    int n;                      // descriptors submitted
+    int reaped;                 // of them known complete
+    std::atomic<bool> cpu_done; // set by the copy thread
+    enum async_backend backend;
+    std::coroutine_handle<> waiter;
+};
+
+struct async_cpu_job
+{
+    struct async_copy *h;
+    void *dst;
+    const void *src;
+    size_t len;
+};
+
+static struct
+{
+    std::mutex lock;
+    std::condition_variable work;
+    std::deque<struct async_cpu_job> jobs;
+    std::vector<std::thread> threads;
+    bool stop;
+} async_cpu_pool;
+
+static std::vector<struct async_copy *> async_pending; // suspended on an unfinished copy
+
+static struct async_copy *async_copy_alloc(void)
+{
+    void *h = aligned_alloc(64, (sizeof(struct async_copy) + 63) & ~63UL);
+
+    return h ? new (h) async_copy() : NULL;
+}
+
+static void async_copy_free(struct async_copy *h)
+{
+    h->~async_copy();
+    free(h);
+}
+
+static void async_cpu_thread(void)
+{
+    struct async_cpu_job job;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(async_cpu_pool.lock);
+
+            async_cpu_pool.work.wait(lock, [] { return async_cpu_pool.stop || !async_cpu_pool.jobs.empty(); });
+            if (async_cpu_pool.jobs.empty())
+                return;
+            job = async_cpu_pool.jobs.front();
+            async_cpu_pool.jobs.pop_front();
+        }
+        memcpy(job.dst, job.src, job.len);
+        job.h->cpu_done.store(true, std::memory_order_release);
+    }
+}
+
+static void async_cpu_start(int nr_threads)
+{
+    async_cpu_pool.stop = false;
+    for (int i = 0; i < nr_threads; i++)
+        async_cpu_pool.threads.emplace_back(async_cpu_thread);
+}
+
+/**
+ * Finish the queued jobs and join the copy threads.
+ */
+static void async_cpu_stop(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(async_cpu_pool.lock);
+
+        async_cpu_pool.stop = true;
+    }
+    async_cpu_pool.work.notify_all();
+    for (auto &t : async_cpu_pool.threads)
+        t.join();
+    async_cpu_pool.threads.clear();
+}
+
+static void async_copy_start(struct async_copy *h, enum async_backend backend, void *dst, const void *src, size_t len)
+{
+    size_t off = 0;
+
+    h->backend = backend;
+    h->n = 0;
+    h->reaped = 0;
+    h->waiter = nullptr;
+    if (backend == ASYNC_CPU)
+    {
+        h->cpu_done.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(async_cpu_pool.lock);
+
+            async_cpu_pool.jobs.push_back({h, dst, src, len});
+        }
+        async_cpu_pool.work.notify_one();
+        return;
+    }
+
+    dsa_prefault_range(dst, len);
+    for (; off < len && h->n < ASYNC_MAX_DESC; h->n++)
+    {
+        struct dsa_wq_info *wq = dsa_stripe_wq(h->n);
+        size_t xfer = std::min(len - off, wq->max_xfer);
+        struct dsa_hw_desc *desc = &h->desc[h->n];
+
+        if (!dsa_wq_has_room(wq, async_inflight))
+            break;
+        async_inflight[wq - dsa_wqs]++;
+        memset(desc, 0, sizeof(*desc));
+        memset(&h->comp[h->n], 0, sizeof(h->comp[h->n]));
+        desc->opcode = DSA_OPCODE_MEMMOVE;
+        desc->flags = dsa_op_flags;
+        desc->xfer_size = xfer;
+        desc->src_addr = (uintptr_t)src + off;
+        desc->dst_addr = (uintptr_t)dst + off;
+        desc->completion_addr = (uintptr_t)&h->comp[h->n];
+        h->sub[h->n] = wq;
+        submit_wi(wq, desc);
+        off += xfer;
+    }
+    if (off < len)
+        memcpy((char *)dst + off, (const char *)src + off, len - off);
+}
+
+/**
+ * Non-blocking completion check. Failed descriptors are resubmitted and
+ * waited for on the spot, the slow path of an otherwise asynchronous copy.
+ *
+ * @return
+ *   true once the whole copy has landed.
+ */
+static bool async_copy_test(struct async_copy *h)
+{
+    if (h->backend == ASYNC_CPU)
+        return h->cpu_done.load(std::memory_order_acquire);
+
+    for (; h->reaped < h->n; h->reaped++)
+    {
+        struct dsa_completion_record *comp = &h->comp[h->reaped];
+
+        if (comp->status == DSA_COMP_NONE)
+            return false;
+        if (comp->status != DSA_COMP_SUCCESS)
+            dsa_resubmit(h->sub[h->reaped], &h->desc[h->reaped], comp);
+        async_inflight[h->sub[h->reaped] - dsa_wqs]--;
+    }
+    return true;
+}
+
+static void async_copy_wait(struct async_copy *h)
+{
+    while (!async_copy_test(h))
+    {
+        // soft WQ engines and cpu copy threads may need this cpu
+        if (h->backend == ASYNC_CPU || dsa_soft)
+            sched_yield();
+        else
+            _mm_pause();
+    }
+}
+
+struct async_copy_awaiter
+{
+    struct async_copy *h;
+
+    bool await_ready()
+    {
+        return async_copy_test(h);
+    }
+
+    void await_suspend(std::coroutine_handle<> coro)
+    {
+        h->waiter = coro;
+        async_pending.push_back(h);
+    }
+
+    void await_resume()
+    {
+    }
+};
+
+/**
+ * Start a copy on h and return the awaitable for it.
+ */
+static struct async_copy_awaiter copy_async(struct async_copy *h, enum async_backend backend, void *dst,
+                                            const void *src, size_t len)
+{
+    async_copy_start(h, backend, dst, src, len);
+    return {h};
+}
+
+/**
+ * Resume every coroutine whose copy has landed.
+ *
+ * @return
+ *   Number of coroutines resumed.
+ */
+static int async_poll(void)
+{
+    static std::vector<struct async_copy *> ready;
+    size_t i = 0;
+
+    ready.clear();
+    while (i < async_pending.size())
+    {
+        if (async_copy_test(async_pending[i]))
+        {
+            ready.push_back(async_pending[i]);
+            async_pending[i] = async_pending.back();
+            async_pending.pop_back();
+        }
+        else
+            i++;
+    }
+    // resumed coroutines may suspend again and append to async_pending
+    for (struct async_copy *h : ready)
+    {
+        std::coroutine_handle<> waiter = h->waiter;
+
+        h->waiter = nullptr;
+        waiter.resume();
+    }
+    return ready.size();
+}
+
+/**
+ * Eagerly started coroutine without result. It stays suspended at its end
+ * so the owner can see it finished; the owner destroys it.
+ */
+struct async_task
+{
+    struct promise_type
+    {
+        async_task get_return_object()
+        {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_never initial_suspend()
+        {
+            return {};
+        }
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> coro;
+};
@@ -0,0 +1,155 @@
+/**
+ * 512-bit counterparts of the avx_varients.h kernels.
+ *
+ * Unlike the 256-bit family these take any d, s and n: a masked store
+ * brings d to a 64-byte boundary, the bulk moves whole cache lines with
+ * aligned stores and a masked load/store pair copies the tail. Masked-off
+ * bytes are never accessed, so nothing outside [s, s + n) is read.
+ * Streaming loads need an aligned source and are only issued when s lands
+ * on a 64-byte boundary once d has been aligned.
+ */
+
+static inline __mmask64 _avx512_mask(size_t n)
+{
+    return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+template <bool NT_STORE, bool NT_LOAD, bool PREFETCH, int UNROLL>
+TARGET_AVX512 static inline void _avx512_cpy_impl(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+    __m512i v[UNROLL];
+    bool s_aligned;
+
+    if (head)
+    {
+        __mmask64 m = _avx512_mask(std::min(head, n));
+
+        _mm512_mask_storeu_epi8(d, m, _mm512_maskz_loadu_epi8(m, s));
+        if (head >= n)
+            return;
+        d += head;
+        s += head;
+        n -= head;
+    }
+    s_aligned = ((uintptr_t)s & 63) == 0;
+
+    for (; n >= 64 * UNROLL; n -= 64 * UNROLL, s += 64 * UNROLL, d += 64 * UNROLL)
+    {
+        if (PREFETCH)
+        {
+            // one iteration ahead, each vector is a full cache line
+            for (int u = 0; u < UNROLL; u++)
+                _mm_prefetch((const char *)s + 64 * (UNROLL + u), _MM_HINT_T0);
+        }
+        for (int u = 0; u < UNROLL; u++)
+        {
+            if (NT_LOAD && s_aligned)
+                v[u] = _mm512_stream_load_si512((void *)(s + 64 * u));
+            else
+                v[u] = _mm512_loadu_si512(s + 64 * u);
+        }
+        for (int u = 0; u < UNROLL; u++)
+        {
+            if (NT_STORE)
+                _mm512_stream_si512((__m512i *)(d + 64 * u), v[u]);
+            else
+                _mm512_store_si512(d + 64 * u, v[u]);
+        }
+    }
+    for (; n >= 64; n -= 64, s += 64, d += 64)
+    {
+        if (NT_STORE)
+            _mm512_stream_si512((__m512i *)d, _mm512_loadu_si512(s));
+        else
+            _mm512_store_si512(d, _mm512_loadu_si512(s));
+    }
+    if (n)
+    {
+        __mmask64 m = _avx512_mask(n);
+
+        _mm512_mask_storeu_epi8(d, m, _mm512_maskz_loadu_epi8(m, s));
+    }
+    if (NT_STORE)
+        _mm_sfence();
+}
+
+TARGET_AVX512 static inline void * _avx512_cpy(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<false, false, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_nt_store_cpy(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, false, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_nt_load_cpy(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<false, true, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_cpy(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, true, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_pf_cpy(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, false, true, 2>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_cpy_unroll2(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<false, false, false, 2>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_cpy_unroll(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<false, false, false, 4>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_cpy_unroll8(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<false, false, false, 8>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_cpy_unroll2(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, true, false, 2>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_cpy_unroll(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, true, false, 4>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_cpy_unroll8(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, true, false, 8>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_pf_cpy_unroll(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, false, true, 4>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_async_pf_cpy_unroll8(void *d, const void *s, size_t n)
+{
+    _avx512_cpy_impl<true, false, true, 8>(d, s, n);
+    return NULL;
+}
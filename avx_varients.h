@@ -8,12 +8,12 @@ static inline void * _rep_movsb(void *d, const void *s, size_t n)
         "rep movsb"          // REP MOVSB instruction
         :                    // No output operands
         : "r" (d), "r" (s), "r" (n)  // Input operands
-        : "rdi", "rsi", "rcx"  // Clobbered registers
+        : "rdi", "rsi", "rcx", "memory"  // Clobbered registers
     );
     return NULL;
 }
 
-static inline void * _avx_cpy(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_cpy(void *d, const void *s, size_t n)
 {
     // d, s -> 32 byte aligned
     // n -> multiple of 32
@@ -29,7 +29,7 @@ static inline void * _avx_cpy(void *d, const void *s, size_t n)
     return NULL;
 }
 
-static inline void * _avx_async_cpy(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_async_cpy(void *d, const void *s, size_t n)
 {
     // d, s -> 32 byte aligned
     // n -> multiple of 32
@@ -46,7 +46,7 @@ static inline void * _avx_async_cpy(void *d, const void *s, size_t n)
     return NULL;
 }
 
-static inline void * _avx_async_pf_cpy(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_async_pf_cpy(void *d, const void *s, size_t n)
 {
     // d, s -> 64 byte aligned
     // n -> multiple of 64
@@ -63,13 +63,14 @@ static inline void * _avx_async_pf_cpy(void *d, const void *s, size_t n)
         _mm256_stream_si256(dVec, _mm256_load_si256(sVec));
         _mm256_stream_si256(dVec + 1, _mm256_load_si256(sVec + 1));
     }
-    _mm256_stream_si256(dVec, _mm256_load_si256(sVec));
-    _mm256_stream_si256(dVec + 1, _mm256_load_si256(sVec + 1));
+    // last iteration without prefetch, never more vectors than were asked for
+    for (; nVec > 0; nVec--, sVec++, dVec++)
+        _mm256_stream_si256(dVec, _mm256_load_si256(sVec));
     _mm_sfence();
     return NULL;
 }
 
-static inline void * _avx_cpy_unroll(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_cpy_unroll(void *d, const void *s, size_t n)
 {
     // d, s -> 128 byte aligned
     // n -> multiple of 128
@@ -77,17 +78,19 @@ static inline void * _avx_cpy_unroll(void *d, const void *s, size_t n)
     auto *dVec = reinterpret_cast<__m256i *>(d);
     const auto *sVec = reinterpret_cast<const __m256i *>(s);
     size_t nVec = n / sizeof(__m256i);
-    for (; nVec > 0; nVec -= 4, sVec += 4, dVec += 4)
+    for (; nVec >= 4; nVec -= 4, sVec += 4, dVec += 4)
     {
         _mm256_store_si256(dVec, _mm256_load_si256(sVec));
         _mm256_store_si256(dVec + 1, _mm256_load_si256(sVec + 1));
         _mm256_store_si256(dVec + 2, _mm256_load_si256(sVec + 2));
         _mm256_store_si256(dVec + 3, _mm256_load_si256(sVec + 3));
     }
+    for (; nVec > 0; nVec--, sVec++, dVec++)
+        _mm256_store_si256(dVec, _mm256_load_si256(sVec));
     return NULL;
 }
 
-static inline void * _avx_async_cpy_unroll(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_async_cpy_unroll(void *d, const void *s, size_t n)
 {
     // d, s -> 128 byte aligned
     // n -> multiple of 128
@@ -95,18 +98,20 @@ static inline void * _avx_async_cpy_unroll(void *d, const void *s, size_t n)
     auto *dVec = reinterpret_cast<__m256i *>(d);
     const auto *sVec = reinterpret_cast<const __m256i *>(s);
     size_t nVec = n / sizeof(__m256i);
-    for (; nVec > 0; nVec -= 4, sVec += 4, dVec += 4)
+    for (; nVec >= 4; nVec -= 4, sVec += 4, dVec += 4)
     {
         _mm256_stream_si256(dVec, _mm256_stream_load_si256(sVec));
         _mm256_stream_si256(dVec + 1, _mm256_stream_load_si256(sVec + 1));
         _mm256_stream_si256(dVec + 2, _mm256_stream_load_si256(sVec + 2));
         _mm256_stream_si256(dVec + 3, _mm256_stream_load_si256(sVec + 3));
     }
+    for (; nVec > 0; nVec--, sVec++, dVec++)
+        _mm256_stream_si256(dVec, _mm256_stream_load_si256(sVec));
     _mm_sfence();
     return NULL;
 }
 
-static inline void * _avx_async_pf_cpy_unroll(void *d, const void *s, size_t n)
+TARGET_AVX2 static inline void * _avx_async_pf_cpy_unroll(void *d, const void *s, size_t n)
 {
     // d, s -> 128 byte aligned
     // n -> multiple of 128
@@ -124,10 +129,156 @@ static inline void * _avx_async_pf_cpy_unroll(void *d, const void *s, size_t n)
         _mm256_stream_si256(dVec + 2, _mm256_load_si256(sVec + 2));
         _mm256_stream_si256(dVec + 3, _mm256_load_si256(sVec + 3));
     }
-    _mm256_stream_si256(dVec, _mm256_load_si256(sVec));
-    _mm256_stream_si256(dVec + 1, _mm256_load_si256(sVec + 1));
-    _mm256_stream_si256(dVec + 2, _mm256_load_si256(sVec + 2));
-    _mm256_stream_si256(dVec + 3, _mm256_load_si256(sVec + 3));
+    // last iteration without prefetch, never more vectors than were asked for
+    for (; nVec > 0; nVec--, sVec++, dVec++)
+        _mm256_stream_si256(dVec, _mm256_load_si256(sVec));
     _mm_sfence();
     return NULL;
-}
\ No newline at end of file
+}
+
+/**
+ * Alignment-agnostic counterparts of the kernels above: any d, s and n.
+ *
+ * Copies below 64 bytes use two overlapping loads/stores of the largest
+ * width that fits. Every case loads before it stores, so _avx_cpy_small is
+ * also safe for overlapping buffers. Larger copies load the first and last
+ * 32 bytes up front, advance d to a 32-byte boundary so every bulk store is
+ * aligned and finish with overlapping unaligned stores of the saved head
+ * and tail. Source loads are aligned (and may stream) only when s ends up
+ * aligned as well.
+ */
+TARGET_AVX2 static inline void _avx_cpy_small(uint8_t *d, const uint8_t *s, size_t n)
+{
+    if (n >= 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+        _mm256_storeu_si256((__m256i *)d, a);
+        _mm256_storeu_si256((__m256i *)(d + n - 32), b);
+    }
+    else if (n >= 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + n - 16));
+        _mm_storeu_si128((__m128i *)d, a);
+        _mm_storeu_si128((__m128i *)(d + n - 16), b);
+    }
+    else if (n >= 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, s, 8);
+        memcpy(&b, s + n - 8, 8);
+        memcpy(d, &a, 8);
+        memcpy(d + n - 8, &b, 8);
+    }
+    else if (n >= 4)
+    {
+        uint32_t a, b;
+        memcpy(&a, s, 4);
+        memcpy(&b, s + n - 4, 4);
+        memcpy(d, &a, 4);
+        memcpy(d + n - 4, &b, 4);
+    }
+    else if (n > 0)
+    {
+        uint8_t a = s[0], b = s[n / 2], c = s[n - 1];
+        d[0] = a;
+        d[n / 2] = b;
+        d[n - 1] = c;
+    }
+}
+
+template <bool NT_STORE, bool NT_LOAD, bool PREFETCH, int UNROLL>
+TARGET_AVX2 static inline void _avx_cpy_any_impl(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d_end = d + n;
+    __m256i head, tail, v[UNROLL];
+    size_t skew;
+    bool s_aligned;
+
+    if (n < 64)
+    {
+        _avx_cpy_small(d, s, n);
+        return;
+    }
+
+    head = _mm256_loadu_si256((const __m256i *)s);
+    tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    s += skew;
+    n -= skew;
+    s_aligned = ((uintptr_t)s & 31) == 0;
+
+    // bulk: strictly more than one block left, the tail vector covers the rest
+    for (; n > 32 * UNROLL; n -= 32 * UNROLL, s += 32 * UNROLL, d += 32 * UNROLL)
+    {
+        if (PREFETCH)
+            _mm_prefetch(s + 32 * UNROLL * 2, _MM_HINT_T0);
+        for (int u = 0; u < UNROLL; u++)
+        {
+            const __m256i *p = (const __m256i *)s + u;
+            if (NT_LOAD && s_aligned)
+                v[u] = _mm256_stream_load_si256(p);
+            else
+                v[u] = _mm256_loadu_si256(p);
+        }
+        for (int u = 0; u < UNROLL; u++)
+        {
+            if (NT_STORE)
+                _mm256_stream_si256((__m256i *)d + u, v[u]);
+            else
+                _mm256_store_si256((__m256i *)d + u, v[u]);
+        }
+    }
+    for (; n > 32; n -= 32, s += 32, d += 32)
+    {
+        if (NT_STORE)
+            _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+        else
+            _mm256_store_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    }
+    if (NT_STORE)
+        _mm_sfence();
+
+    _mm256_storeu_si256((__m256i *)dst, head);
+    _mm256_storeu_si256((__m256i *)(d_end - 32), tail);
+}
+
+TARGET_AVX2 static inline void * _avx_cpy_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<false, false, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_async_cpy_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<true, true, false, 1>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_async_pf_cpy_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<true, false, true, 2>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_cpy_unroll_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<false, false, false, 4>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_async_cpy_unroll_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<true, true, false, 4>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_async_pf_cpy_unroll_any(void *d, const void *s, size_t n)
+{
+    _avx_cpy_any_impl<true, false, true, 4>(d, s, n);
+    return NULL;
+}
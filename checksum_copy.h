@@ -0,0 +1,357 @@
+/**
+ * Copies that also checksum the data, fused into one pass or as a copy
+ * followed by a separate checksum pass over the destination.
+ *
+ * The kernels keep the copy_func_t signature so the regular drivers can
+ * time them; the checksum of the last call is left in copy_checksum.
+ * CRC32C is the Castagnoli CRC as used by iSCSI and ext4 (initial value and
+ * final xor ~0), xxh64 is XXH64 with seed 0. The crc32 instruction is
+ * SSE4.2, which every AVX2 capable cpu has, so the kernels share TARGET_AVX2.
+ */
+static uint64_t copy_checksum;
+
+/**
+ * Bitwise CRC32C, only used to check the fast paths.
+ */
+static uint32_t crc32c_ref(const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint32_t crc = ~0U;
+
+    while (n--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0U - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/**
+ * Multiply a and b modulo the CRC32C polynomial, bit-reflected like the
+ * CRC itself (x^0 is the top bit).
+ */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31, p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ 0x82f63b78 : b >> 1;
+    }
+    return p;
+}
+
+/**
+ * x^(8 * n) modulo the polynomial. Chunked copies keep asking for the same
+ * n, so the last answer is kept per thread.
+ */
+static uint32_t crc32c_shift_bytes(size_t n)
+{
+    static thread_local size_t last_n = 0;
+    static thread_local uint32_t last_p = 1U << 31;
+    uint32_t p = 1U << 31, x = 1U << 30;
+    size_t e = n * 8;
+
+    if (n == last_n)
+        return last_p;
+    for (; e; e >>= 1)
+    {
+        if (e & 1)
+            p = crc32c_multmodp(x, p);
+        x = crc32c_multmodp(x, x);
+    }
+    last_n = n;
+    last_p = p;
+    return p;
+}
+
+/**
+ * CRC of A followed by B from crc(A), crc(B) and the length of B.
+ */
+static inline uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+    return crc32c_multmodp(crc32c_shift_bytes(len_b), crc_a) ^ crc_b;
+}
+
+/**
+ * crc32 has a 3 cycle latency and a throughput of one per cycle, so one
+ * chain leaves two thirds of the unit idle. Inputs of at least
+ * CRC32C_3WAY_MIN bytes are cut into three equal streams that are run
+ * interleaved and merged with crc32c_combine(), the remainder continues the
+ * merged CRC. With COPY set every byte read is also stored to d.
+ */
+#define CRC32C_3WAY_MIN 8192 // below this the two combines cost more than they save
+
+template <bool COPY>
+TARGET_AVX2 static inline uint32_t crc32c_pass(uint8_t *d, const uint8_t *s, size_t n)
+{
+    uint64_t crc = ~0U;
+    uint64_t w;
+
+    if (n >= CRC32C_3WAY_MIN)
+    {
+        size_t len = n / 96 * 32; // per stream, whole ymm moves
+        uint64_t crc_b = ~0U, crc_c = ~0U;
+        uint64_t a[4], b[4], c[4];
+
+        for (size_t off = 0; off < len; off += 32)
+        {
+            if (COPY)
+            {
+                _mm256_storeu_si256((__m256i *)(d + off), _mm256_loadu_si256((const __m256i *)(s + off)));
+                _mm256_storeu_si256((__m256i *)(d + len + off), _mm256_loadu_si256((const __m256i *)(s + len + off)));
+                _mm256_storeu_si256((__m256i *)(d + 2 * len + off), _mm256_loadu_si256((const __m256i *)(s + 2 * len + off)));
+            }
+            memcpy(a, s + off, 32);
+            memcpy(b, s + len + off, 32);
+            memcpy(c, s + 2 * len + off, 32);
+            for (int i = 0; i < 4; i++)
+            {
+                crc = _mm_crc32_u64(crc, a[i]);
+                crc_b = _mm_crc32_u64(crc_b, b[i]);
+                crc_c = _mm_crc32_u64(crc_c, c[i]);
+            }
+        }
+        crc = crc32c_combine(~(uint32_t)crc, ~(uint32_t)crc_b, len);
+        crc = ~crc32c_combine((uint32_t)crc, ~(uint32_t)crc_c, len) & 0xffffffffU;
+        s += 3 * len;
+        if (COPY)
+            d += 3 * len;
+        n -= 3 * len;
+    }
+
+    for (; n >= 8; n -= 8, s += 8)
+    {
+        memcpy(&w, s, 8);
+        if (COPY)
+        {
+            memcpy(d, &w, 8);
+            d += 8;
+        }
+        crc = _mm_crc32_u64(crc, w);
+    }
+    for (; n > 0; n--, s++)
+    {
+        if (COPY)
+            *d++ = *s;
+        crc = _mm_crc32_u8((uint32_t)crc, *s);
+    }
+    return ~(uint32_t)crc;
+}
+
+TARGET_AVX2 static inline uint32_t crc32c(const void *buf, size_t n)
+{
+    return crc32c_pass<false>(NULL, (const uint8_t *)buf, n);
+}
+
+/**
+ * Copy with ymm moves and feed the same bytes, now in L1, to the crc32
+ * unit in three interleaved chains.
+ */
+TARGET_AVX2 static inline void * copy_crc32c(void *dst, const void *src, size_t n)
+{
+    copy_checksum = crc32c_pass<true>((uint8_t *)dst, (const uint8_t *)src, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * copy_then_crc32c(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+    copy_checksum = crc32c(dst, n);
+    return NULL;
+}
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    return xxh_rotl(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t h, uint64_t v)
+{
+    h ^= xxh_round(0, v);
+    return h * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+struct xxh64_state
+{
+    uint64_t v[4];
+};
+
+static inline void xxh64_reset(struct xxh64_state *st)
+{
+    st->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    st->v[1] = XXH_PRIME64_2;
+    st->v[2] = 0;
+    st->v[3] = 0 - XXH_PRIME64_1;
+}
+
+/**
+ * Fold the accumulators and the tail of fewer than 32 bytes into the hash
+ * of a total bytes long input.
+ */
+static uint64_t xxh64_finish(const struct xxh64_state *st, const uint8_t *p, size_t n, size_t total)
+{
+    uint64_t h, k;
+    uint32_t k32;
+
+    if (total >= 32)
+    {
+        h = xxh_rotl(st->v[0], 1) + xxh_rotl(st->v[1], 7) + xxh_rotl(st->v[2], 12) + xxh_rotl(st->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = xxh_merge(h, st->v[i]);
+    }
+    else
+        h = XXH_PRIME64_5;
+    h += total;
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&k, p, 8);
+        h ^= xxh_round(0, k);
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (n >= 4)
+    {
+        memcpy(&k32, p, 4);
+        h ^= (uint64_t)k32 * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        n -= 4;
+        p += 4;
+    }
+    for (; n > 0; n--, p++)
+    {
+        h ^= *p * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh64(const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    struct xxh64_state st;
+    size_t total = n;
+    uint64_t w[4];
+
+    xxh64_reset(&st);
+    for (; n >= 32; n -= 32, p += 32)
+    {
+        memcpy(w, p, 32);
+        for (int i = 0; i < 4; i++)
+            st.v[i] = xxh_round(st.v[i], w[i]);
+    }
+    return xxh64_finish(&st, p, n, total);
+}
+
+/**
+ * xxh64 stripes are 32 bytes, one ymm move per stripe while its four lanes
+ * go through the multiply-rotate rounds.
+ */
+TARGET_AVX2 static inline void * copy_xxh64(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    struct xxh64_state st;
+    size_t total = n;
+    uint64_t w[4], v0, v1, v2, v3;
+
+    // accumulators in locals, the ymm store could otherwise alias st
+    xxh64_reset(&st);
+    v0 = st.v[0];
+    v1 = st.v[1];
+    v2 = st.v[2];
+    v3 = st.v[3];
+    for (; n >= 32; n -= 32, s += 32, d += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)s);
+
+        memcpy(w, s, 32);
+        _mm256_storeu_si256((__m256i *)d, x);
+        v0 = xxh_round(v0, w[0]);
+        v1 = xxh_round(v1, w[1]);
+        v2 = xxh_round(v2, w[2]);
+        v3 = xxh_round(v3, w[3]);
+    }
+    st.v[0] = v0;
+    st.v[1] = v1;
+    st.v[2] = v2;
+    st.v[3] = v3;
+    memcpy(d, s, n);
+    copy_checksum = xxh64_finish(&st, s, n, total);
+    return NULL;
+}
+
+static inline void * copy_then_xxh64(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+    copy_checksum = xxh64(dst, n);
+    return NULL;
+}
+
+/**
+ * Offloaded equivalent of copy_crc32c, the cpu only submits and polls.
+ */
+static inline void * copy_crc32c_dsa(void *dst, const void *src, size_t n)
+{
+    copy_checksum = copy_crc_dsa(dst, src, n);
+    return NULL;
+}
+
+/**
+ * Run func over a few awkward sizes and check both the copy and the
+ * checksum it leaves in copy_checksum against ref over the source.
+ *
+ * @return
+ *   true when every size matched.
+ */
+static bool checksum_check(copy_func_t func, uint64_t (*ref)(const void *, size_t))
+{
+    static const size_t sizes[] = {0, 1, 7, 8, 31, 32, 33, 100, 4096, 8191, 8192, 8192 + 95, 65536 + 13};
+    size_t max = 65536 + 13;
+    uint8_t *src = (uint8_t *)malloc(max);
+    uint8_t *dst = (uint8_t *)malloc(max);
+    bool ok = src && dst;
+
+    for (size_t i = 0; i < max && ok; i++)
+        src[i] = (uint8_t)(i * 131 + (i >> 7));
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && ok; i++)
+    {
+        memset(dst, 0, max);
+        func(dst, src, sizes[i]);
+        ok = memcmp(dst, src, sizes[i]) == 0 && copy_checksum == ref(src, sizes[i]);
+    }
+    free(src);
+    free(dst);
+    return ok;
+}
+
+static uint64_t crc32c_ref64(const void *buf, size_t n)
+{
+    return crc32c_ref(buf, n);
+}
@@ -0,0 +1,319 @@
+typedef void *(*copy_func_t)(void *dst, const void *src, long unsigned int n);
+
+struct copy_impl
+{
+    const char *name;
+    copy_func_t func;
+};
+
+#define DISPATCH_MAX_CLASSES 16
+
+/**
+ * dispatch_memcpy picks the last class whose min_size is <= n. Classes are
+ * kept sorted by min_size and the first one always starts at 0.
+ */
+struct dispatch_class
+{
+    size_t min_size;
+    struct copy_impl impl;
+};
+
+static struct dispatch_class dispatch_classes[DISPATCH_MAX_CLASSES];
+static int dispatch_nr_classes;
+
+static void *memcpy_rep_movsb(void *dst, const void *src, size_t n)
+{
+    _rep_movsb(dst, src, n);
+    return dst;
+}
+
+/**
+ * Copy bytes with 256-bit vectors, any alignment and any size.
+ * Head and tail are handled with overlapping unaligned accesses and the
+ * bulk is stored 32-byte aligned.
+ */
+TARGET_AVX2 static void *memcpy_avx2(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    __m256i head, tail;
+    size_t skew;
+
+    if (n < 16)
+    {
+        if (n >= 8)
+        {
+            uint64_t a, b;
+            memcpy(&a, s, 8);
+            memcpy(&b, s + n - 8, 8);
+            memcpy(d, &a, 8);
+            memcpy(d + n - 8, &b, 8);
+        }
+        else if (n >= 4)
+        {
+            uint32_t a, b;
+            memcpy(&a, s, 4);
+            memcpy(&b, s + n - 4, 4);
+            memcpy(d, &a, 4);
+            memcpy(d + n - 4, &b, 4);
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++)
+                d[i] = s[i];
+        }
+        return dst;
+    }
+    if (n <= 32)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + n - 16));
+        _mm_storeu_si128((__m128i *)d, a);
+        _mm_storeu_si128((__m128i *)(d + n - 16), b);
+        return dst;
+    }
+    if (n <= 64)
+    {
+        head = _mm256_loadu_si256((const __m256i *)s);
+        tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+        _mm256_storeu_si256((__m256i *)d, head);
+        _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+        return dst;
+    }
+
+    head = _mm256_loadu_si256((const __m256i *)s);
+    tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    uint8_t *d_end = d + n;
+
+    // advance to the next 32-byte boundary of dst, head covers the skipped bytes
+    skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    s += skew;
+    n -= skew;
+
+    for (; n > 128; n -= 128, s += 128, d += 128)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)s + 0);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)s + 1);
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)s + 2);
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)s + 3);
+        _mm256_store_si256((__m256i *)d + 0, v0);
+        _mm256_store_si256((__m256i *)d + 1, v1);
+        _mm256_store_si256((__m256i *)d + 2, v2);
+        _mm256_store_si256((__m256i *)d + 3, v3);
+    }
+    for (; n > 32; n -= 32, s += 32, d += 32)
+        _mm256_store_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+
+    // at most 32 bytes remain, the tail vector covers them
+    _mm256_storeu_si256((__m256i *)dst, head);
+    _mm256_storeu_si256((__m256i *)(d_end - 32), tail);
+    return dst;
+}
+
+/**
+ * Same as memcpy_avx2 but the aligned bulk is written with non-temporal
+ * stores, so the destination does not displace the cache.
+ */
+TARGET_AVX2 static void *memcpy_avx2_nt(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    __m256i head, tail;
+    size_t skew;
+
+    if (n <= 128)
+        return memcpy_avx2(dst, src, n);
+
+    head = _mm256_loadu_si256((const __m256i *)s);
+    tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    uint8_t *d_end = d + n;
+
+    skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    s += skew;
+    n -= skew;
+
+    for (; n > 128; n -= 128, s += 128, d += 128)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)s + 0);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)s + 1);
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)s + 2);
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)s + 3);
+        _mm256_stream_si256((__m256i *)d + 0, v0);
+        _mm256_stream_si256((__m256i *)d + 1, v1);
+        _mm256_stream_si256((__m256i *)d + 2, v2);
+        _mm256_stream_si256((__m256i *)d + 3, v3);
+    }
+    for (; n > 32; n -= 32, s += 32, d += 32)
+        _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    _mm_sfence();
+
+    _mm256_storeu_si256((__m256i *)dst, head);
+    _mm256_storeu_si256((__m256i *)(d_end - 32), tail);
+    return dst;
+}
+
+static void *memcpy_dsa(void *dst, const void *src, size_t n)
+{
+    return copy_dsa(dst, src, n);
+}
+
+/**
+ * Every implementation dispatch_memcpy may bind, filtered by what this host
+ * supports. Filled by dispatch_init().
+ */
+static struct copy_impl dispatch_impls[8];
+static int dispatch_nr_impls;
+
+static const struct copy_impl *dispatch_find_impl(const char *name)
+{
+    for (int i = 0; i < dispatch_nr_impls; i++)
+    {
+        if (!strcmp(dispatch_impls[i].name, name))
+            return &dispatch_impls[i];
+    }
+    return NULL;
+}
+
+static void dispatch_set_default(void)
+{
+    struct copy_impl small = {"memcpy", memcpy};
+    struct copy_impl medium = small;
+    struct copy_impl large = small;
+
+    // short copies: ymm has no frequency license cost, fsrm makes rep movsb cheap to start
+    if (cpu_features.avx2)
+        small = {"memcpy_avx2", memcpy_avx2};
+    else if (cpu_features.fsrm)
+        small = {"rep_movsb", memcpy_rep_movsb};
+
+    if (cpu_features.avx512)
+        medium = {"rte_memcpy", rte_memcpy};
+    else if (cpu_features.avx2)
+        medium = {"memcpy_avx2", memcpy_avx2};
+    else if (cpu_features.erms)
+        medium = {"rep_movsb", memcpy_rep_movsb};
+
+    // long copies: erms microcode uses full cache line transfers
+    if (cpu_features.erms)
+        large = {"rep_movsb", memcpy_rep_movsb};
+    else if (cpu_features.avx512)
+        large = {"rte_memcpy", rte_memcpy};
+    else if (cpu_features.avx2)
+        large = {"memcpy_avx2", memcpy_avx2};
+
+    dispatch_classes[0] = {0, small};
+    dispatch_classes[1] = {256, medium};
+    dispatch_classes[2] = {4096, large};
+    dispatch_nr_classes = 3;
+}
+
+/**
+ * Replace the size classes with a profile written by dispatch_save_profile().
+ * Lines are "<min_size> <impl>", '#' starts a comment. A profile naming an
+ * implementation this host lacks is rejected as a whole.
+ */
+static int dispatch_load_profile(const char *path)
+{
+    struct dispatch_class classes[DISPATCH_MAX_CLASSES];
+    char line[256], name[64];
+    unsigned long min_size;
+    int n = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+    {
+        printf("open %s failed with errno = %d.\n", path, errno);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        const struct copy_impl *impl;
+
+        if (line[0] == '#' || sscanf(line, "%lu %63s", &min_size, name) != 2)
+            continue;
+        impl = dispatch_find_impl(name);
+        if (!impl || n == DISPATCH_MAX_CLASSES || (n == 0 && min_size != 0) ||
+            (n > 0 && min_size <= classes[n - 1].min_size))
+        {
+            printf("profile %s: rejected entry '%lu %s'\n", path, min_size, name);
+            fclose(f);
+            return -1;
+        }
+        classes[n++] = {min_size, *impl};
+    }
+    fclose(f);
+
+    if (n == 0)
+    {
+        printf("profile %s: no size classes\n", path);
+        return -1;
+    }
+    memcpy(dispatch_classes, classes, sizeof(classes[0]) * n);
+    dispatch_nr_classes = n;
+    return 0;
+}
+
+static int dispatch_save_profile(const char *path, const char *comment)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f)
+    {
+        printf("open %s failed with errno = %d.\n", path, errno);
+        return -1;
+    }
+    fprintf(f, "# copy_user tuning profile\n# %s\n# min_size impl\n", comment);
+    for (int i = 0; i < dispatch_nr_classes; i++)
+        fprintf(f, "%zu %s\n", dispatch_classes[i].min_size, dispatch_classes[i].impl.name);
+    fclose(f);
+    return 0;
+}
+
+static void dispatch_print(void)
+{
+    printf("Dispatch:");
+    for (int i = 0; i < dispatch_nr_classes; i++)
+        printf(" [%zu..) %s", dispatch_classes[i].min_size, dispatch_classes[i].impl.name);
+    printf("\n");
+}
+
+/**
+ * Register the implementations this cpu can run and bind the size classes,
+ * either from a tuning profile or from CPUID defaults. Must run after
+ * cpu_features_init() and, to make DSA selectable, after the portal is mapped.
+ */
+static void dispatch_init(const char *profile)
+{
+    dispatch_nr_impls = 0;
+    dispatch_impls[dispatch_nr_impls++] = {"memcpy", memcpy};
+    dispatch_impls[dispatch_nr_impls++] = {"rep_movsb", memcpy_rep_movsb};
+    if (cpu_features.avx2)
+    {
+        dispatch_impls[dispatch_nr_impls++] = {"memcpy_avx2", memcpy_avx2};
+        dispatch_impls[dispatch_nr_impls++] = {"memcpy_avx2_nt", memcpy_avx2_nt};
+    }
+    if (cpu_features.avx512)
+        dispatch_impls[dispatch_nr_impls++] = {"rte_memcpy", rte_memcpy};
+    if (dsa_wq)
+        dispatch_impls[dispatch_nr_impls++] = {"dsa", memcpy_dsa};
+
+    dispatch_set_default();
+    if (profile && dispatch_load_profile(profile) != 0)
+    {
+        printf("profile %s not usable, keeping CPUID defaults\n", profile);
+        dispatch_set_default();
+    }
+    dispatch_print();
+}
+
+static void *dispatch_memcpy(void *dst, const void *src, size_t n)
+{
+    int i = dispatch_nr_classes - 1;
+
+    while (i > 0 && n < dispatch_classes[i].min_size)
+        i--;
+    return dispatch_classes[i].impl.func(dst, src, n);
+}
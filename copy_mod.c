@@ -33,6 +33,7 @@ static bool verified = true;
 #define GB_TO_BYTES(x) ((unsigned long)(x) << 30)
 #define KB_TO_BYTES(x) ((unsigned long)(x) << 10)
 #define ALIGNMENT_MASK 0x3F
+#define VERIFY_BLOCK (64UL << 20)
 
 /**
  * Copy bytes from one location to another. The locations must not overlap.
@@ -431,24 +432,51 @@ static int allocate_and_initialize_arrays(void)
     return 0;
 }
 
+/*
+ * Offset of the first differing byte, or n if equal. Compares a word at a
+ * time and only walks bytes inside the differing word.
+ */
+static unsigned long find_mismatch(const void *a, const void *b, unsigned long n)
+{
+    const u64 *wa = a, *wb = b;
+    unsigned long words = n / sizeof(u64);
+    unsigned long i;
+
+    for (i = 0; i < words; i++)
+    {
+        if (wa[i] != wb[i])
+            break;
+    }
+    for (i *= sizeof(u64); i < n; i++)
+    {
+        if (((const u8 *)a)[i] != ((const u8 *)b)[i])
+            return i;
+    }
+    return n;
+}
+
 static int verify_copy(void)
 {
     unsigned long size = GB_TO_BYTES(n_gb);
-    unsigned long i;
+    unsigned long off, len, i;
 
     if (verified != true)
     {
         return false;
     }
 
-    for (i = 0; i < size; i++)
+    for (off = 0; off < size; off += len)
     {
-        if (((char *)array1)[i] != ((char *)array2)[i])
+        len = min(size - off, VERIFY_BLOCK);
+        i = find_mismatch(array1 + off, array2 + off, len);
+        if (i != len)
         {
+            i += off;
             pr_err("Verification failed at offset %lu, total size %lu, a1 %d a2 %d\n", i, size, ((char *)array1)[i], ((char *)array2)[i]);
             verified = false;
             return verified;
         }
+        cond_resched();
     }
 
     pr_info("Verification successful\n");
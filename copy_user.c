@@ -7,14 +7,35 @@
 #include <string.h>
 #include <immintrin.h>
 #include <sys/mman.h>
+#include <getopt.h>
 
+#include <atomic>
 #include <cstdlib>
 #include <thread>
 #include <vector>
 
+#include "cpu_features.h"
+#include "mem_alloc.h"
 #include "rte_copy.h"
 #include "avx_varients.h"
+#include "avx512_varients.h"
 #include "dsa_copy.h"
+#include "dsa_wqs.h"
+#include "dsa_queue.h"
+#include "copy_dispatch.h"
+#include "cpu_topology.h"
+#include "tsc.h"
+#include "latency_hist.h"
+#include "perf_counters.h"
+#include "verify.h"
+#include "access_pattern.h"
+#include "fixed_copy.h"
+#include "memmove_varients.h"
+#include "fill_varients.h"
+#include "checksum_copy.h"
+#include "dsa_soft.h"
+#include "hybrid_copy.h"
+#include "async_copy.h"
 
 #define GB_TO_BYTES(x) ((unsigned long)(x) << 30)
 #define KB_TO_BYTES(x) ((unsigned long)(x) << 10)
@@ -22,14 +43,81 @@
 #define MB (KB * 1024)
 #define GB (MB * 1024)
 #define ALIGNMENT_MASK 0x3F
-#define COPY_USING(func)                               \
-    do                                                 \
-    {                                                  \
-        printf("Copying using function: %s\n", #func); \
-        copy_driver(func);                             \
+// copies shorter than this are timed in batches so the timer does not dominate
+#define LATENCY_BATCH_BYTES (4 * KB)
+// granularity of parallel and sampled verification
+#define VERIFY_BLOCK (64 * KB)
+// buffer initialization is split at huge page boundaries
+#define INIT_SLICE (2 * MB)
+// fixed size mode: copies rotate over FIXED_WINDOW slots of FIXED_STRIDE bytes
+#define FIXED_WINDOW 64
+#define FIXED_STRIDE (FIXED_COPY_MAX + 64)
+#define FIXED_ITERS (1UL << 20)
+#define ASYNC_INFLIGHT 4      // coroutines copying concurrently in async mode
+#define ASYNC_WORK_ROUNDS 256 // multiply steps per unit of synthetic work
+#define CONSUME_STOP (~0UL)   // consume_posted value that ends the consumer thread
+#define COPY_USING(func)          \
+    do                            \
+    {                             \
+        run_variant(#func, func); \
+    } while (0)
+// skip variants whose instructions or device are missing on this host
+#define RUN_VARIANT_IF(func, cond, flags)                             \
+    do                                                                \
+    {                                                                 \
+        if (cond)                                                     \
+            run_variant(#func, func, flags);                          \
+        else if (variant_selected(#func))                             \
+            printf("Skipping %s: not supported on this host\n", #func); \
+    } while (0)
+#define COPY_USING_IF(func, cond) RUN_VARIANT_IF(func, cond, 0)
+// kernels that require 32-byte aligned buffers, skipped by the alignment sweep
+#define COPY_USING_ALIGNED_IF(func, cond) RUN_VARIANT_IF(func, cond, VARIANT_ALIGNED)
+// kernels that handle overlapping buffers, the only ones run by the overlap sweep
+#define MOVE_USING_IF(func, cond) RUN_VARIANT_IF(func, cond, VARIANT_OVERLAP)
+// kernels that spread copies over dsa_stripe_width WQs, the only ones run by the WQ sweep
+#define STRIPE_USING_IF(func, cond) RUN_VARIANT_IF(func, cond, VARIANT_STRIPED)
+// kernels that only queue the copy, drain completes everything queued so far
+#define COPY_ASYNC_USING_IF(func, drain, cond, flags)          \
+    do                                                         \
+    {                                                          \
+        copy_drain = drain;                                    \
+        RUN_VARIANT_IF(func, cond, VARIANT_ASYNC | (flags));   \
+        copy_drain = NULL;                                     \
+    } while (0)
+
+#define FILL_USING_IF(func, cond)                                     \
+    do                                                                \
+    {                                                                 \
+        if (cond)                                                     \
+            run_fill_variant(#func, func);                            \
+        else if (mode == MODE_FILL && variant_selected(#func))        \
+            printf("Skipping %s: not supported on this host\n", #func); \
     } while (0)
 
-typedef void *(*copy_func_t)(void *dst, const void *src, long unsigned int n);
+#define VARIANT_ALIGNED 0x1 // needs 32-byte aligned buffers
+#define VARIANT_OVERLAP 0x2 // memmove semantics
+#define VARIANT_ASYNC 0x4   // returns before the copy lands, see copy_drain
+#define VARIANT_STRIPED 0x8 // uses dsa_stripe_width WQs
+
+enum run_mode
+{
+    MODE_SINGLE,    // one thread, every chunk size
+    MODE_THREADS,   // thread scaling over placements, every chunk size
+    MODE_NUMA,      // source node x destination node matrix, every chunk size
+    MODE_PAGES,     // every page backing, every chunk size
+    MODE_CALIBRATE, // size sweep over dispatch implementations, writes a profile
+    MODE_LATENCY,   // per-copy latency percentiles, every chunk size
+    MODE_PATTERNS,  // every access pattern, every chunk size
+    MODE_ALIGN,     // source/destination misalignment sweep, every chunk size
+    MODE_FIXED,     // per-call cost of compile-time vs runtime sized copies of 1..512 bytes
+    MODE_OVERLAP,   // memmove kernels over overlap distances, every chunk size
+    MODE_FILL,      // fill kernels instead of copies, every chunk size
+    MODE_WQS,       // DSA striping over a growing number of WQs, every chunk size
+    MODE_ASYNC,     // coroutine copies overlapped with synthetic work, every chunk size
+    MODE_WAIT,      // copy_dsa latency and waiting cost per wait strategy, every chunk size
+    MODE_CONSUME,   // copy then read by a consumer thread, DSA with/without cache control vs cpu
+};
 
 static unsigned long n_gb = 2; // Default 1 GB
 static void *array1 = NULL;
@@ -42,6 +130,34 @@ static bool verified = true;
 static int block_size_min = 1 * KB;
 static int block_size_max = 2 * MB;
 
+static enum run_mode mode = MODE_SINGLE;
+static const char *variant_filter = NULL;
+static int max_threads = 0; // 0 -> every allowed cpu
+static int src_node = NUMA_NODE_ANY;
+static int dst_node = NUMA_NODE_ANY;
+static int cpu_node = NUMA_NODE_ANY; // node the copying thread runs on
+static const char *profile_in = NULL;
+static const char *profile_out = "copy_tune.profile";
+static unsigned long calibrate_bytes = 64 * MB; // copied per size and implementation
+static bool use_perf = false;
+static unsigned long verify_sample = 1; // verify 1 in N blocks, 1 -> everything
+static unsigned long verify_threads = 0; // 0 -> one per allowed cpu
+static unsigned long init_threads = 0;   // 0 -> one per allowed cpu
+
+enum reset_mode
+{
+    RESET_FILL,       // refill array2 before every pass
+    RESET_GENERATION, // stamp a new generation into array1 instead
+    RESET_DROP,       // give array2's pages back, every pass writes to cold memory
+};
+static enum reset_mode reset_mode = RESET_FILL;
+static uint64_t reset_generation = 0;
+static unsigned long align_step = 8;     // offset increment of the alignment sweep
+static const char *fill_name = NULL;     // buffer fill, NULL -> fastest available
+static double llc_fraction = 0.75;       // of the per-cpu LLC share, where rte_memcpy starts streaming
+static const char *dsa_wq_spec = NULL;   // -w list of WQs, NULL -> every enabled user WQ in sysfs
+static void (*copy_drain)(void) = NULL;  // set while an asynchronous variant runs
+
 static void deallocate(void *ptr, size_t size)
 {
     if (munmap(ptr, size) == -1)
@@ -58,163 +174,2077 @@ static void cleanup_arrays(void)
     {
         deallocate(array1, size);
         deallocate(array2, size);
+        array1 = NULL;
+        array2 = NULL;
         printf("Arrays freed\n");
     }
 }
 
+static unsigned long now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static inline unsigned long mix64(unsigned long x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * fill_func_t that ignores c and stores mix64() of each 8 byte word's
+ * address, so bytes copied to the wrong place, moved in the wrong direction
+ * or shifted by a few bytes do not compare equal to the source.
+ */
+static void *fill_position(void *d, int /*c*/, size_t n)
+{
+    uint64_t *p = (uint64_t *)d;
+    uint8_t *tail = (uint8_t *)d + (n & ~7UL);
+
+    for (size_t i = 0; i < n / 8; i++)
+        p[i] = mix64((uintptr_t)&p[i]);
+    for (size_t i = 0; i < (n & 7); i++)
+        tail[i] = (uint8_t)mix64((uintptr_t)&tail[i]);
+    return d;
+}
+
+/**
+ * One slice of parallel_fill() on the thread that owns it: pinned first
+ * when cpu is set, so the slice is placed by that cpu, populated in bulk
+ * when asked, then filled.
+ */
+static void fill_slice(fill_func_t func, int cpu, void *buf, int c, unsigned long len, bool populate)
+{
+    static bool warned = false;
+
+    if (cpu >= 0)
+        pin_thread_to_cpu(pthread_self(), cpu);
+    if (populate && madvise(buf, len, MADV_POPULATE_WRITE) != 0 &&
+        !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED))
+        printf("madvise MADV_POPULATE_WRITE failed with errno = %d, pages fault on first touch\n", errno);
+    func(buf, c, len);
+}
+
+/**
+ * Fill buf with buffer_fill from init_threads threads, each taking a
+ * contiguous slice. The first write to a page places it, so unless the
+ * buffer is bound to a node every slice lands on the node of the thread
+ * filling it. When the topology is known (threads mode) the threads are
+ * pinned in spread order, which puts slice t next to the t-th worker of a
+ * spread placement running a sequential pattern; slice 0 gets a thread
+ * too, so that it is placed like the others. func replaces buffer_fill when
+ * given; populate pre-faults each slice from its own thread (-M).
+ */
+static void parallel_fill(void *buf, int c, unsigned long size, fill_func_t func = NULL, bool populate = false)
+{
+    unsigned long nr_slices = (size + INIT_SLICE - 1) / INIT_SLICE;
+    unsigned long nr_threads = init_threads;
+    std::vector<std::thread> threads;
+    int cpus[MAX_CPUS];
+    int nr_cpus = 0;
+    cpu_set_t set;
+
+    if (nr_threads == 0)
+    {
+        sched_getaffinity(0, sizeof(set), &set);
+        nr_threads = CPU_COUNT(&set);
+    }
+    // DSA fills all go through one work queue, more submitters only contend on it
+    if (!func)
+        func = buffer_fill.func;
+    if (func == fill_dsa)
+        nr_threads = 1;
+    nr_threads = std::max(1UL, std::min(nr_threads, nr_slices));
+    if (cpu_topology_count > 0)
+        nr_cpus = cpu_placement(false, true, cpus, MAX_CPUS);
+
+    for (unsigned long t = 0; t < nr_threads; t++)
+    {
+        unsigned long first = nr_slices * t / nr_threads * INIT_SLICE;
+        unsigned long last = std::min(size, nr_slices * (t + 1) / nr_threads * INIT_SLICE);
+
+        threads.emplace_back(fill_slice, func, nr_cpus > 0 ? cpus[t % nr_cpus] : -1, (char *)buf + first, c,
+                             last - first, populate);
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+/**
+ * Cheap replacement for refilling array2: give array1 a new tag at the
+ * first and last 8 bytes of every block_size_min block. Every chunk starts
+ * and ends on such a block boundary, so a chunk the variant skipped or cut
+ * short keeps the previous pass's tags in array2 and fails verification,
+ * at the cost of two stores per block instead of rewriting the buffer. A
+ * copy that drops bytes strictly inside a chunk goes unnoticed.
+ */
+static void stamp_generation(void)
+{
+    unsigned long size = GB_TO_BYTES(n_gb);
+    unsigned long block = block_size_min;
+    uint64_t gen = ++reset_generation;
+
+    for (unsigned long off = 0; off + block <= size; off += block)
+    {
+        uint64_t tag = gen << 40 | off / block;
+
+        memcpy((char *)array1 + off, &tag, sizeof(tag));
+        tag = ~tag;
+        memcpy((char *)array1 + off + block - sizeof(tag), &tag, sizeof(tag));
+    }
+}
+
 static int allocate_and_initialize_arrays(void)
 {
     unsigned long size = GB_TO_BYTES(n_gb);
+    unsigned long start_time;
     // do not reallocate if the already allocated does not fit into cache
     if (array1 && array2)
     {
-        memset(array2, 2, size);
+        // fill mode compares array2 against an untouched array1
+        if (reset_mode == RESET_GENERATION && mode != MODE_FILL)
+            stamp_generation();
+        else if (reset_mode == RESET_DROP)
+            madvise(array2, size, MADV_DONTNEED);
+        else
+            parallel_fill(array2, 2, size);
         return 0;
     }
 
-    array1 = allocate(size);
+    array1 = allocate(size, src_node);
     if (!array1)
     {
         printf("Failed to allocate array1\n");
         return -1;
     }
 
-    array2 = allocate(size);
+    array2 = allocate(size, dst_node);
     if (!array2)
     {
         printf("Failed to allocate array2\n");
-        free(array1);
+        deallocate(array1, size);
+        array1 = NULL;
         return -1;
     }
 
-    // Initialize array1 with 1s
-    memset(array1, 1, size);
+    start_time = now_ns();
+    // Initialize array1 with 1s for fill mode, which writes 1s, with a position pattern otherwise
+    if (mode == MODE_FILL)
+        parallel_fill(array1, 1, size, NULL, prefault);
+    else
+        parallel_fill(array1, 1, size, fill_position, prefault);
 
     // Initialize array2 with 2s
-    memset(array2, 2, size);
-    printf("Arrays allocated and initialized: %lu GB each\n", n_gb);
+    parallel_fill(array2, 2, size, NULL, prefault);
+    if (reset_mode == RESET_DROP)
+        madvise(array2, size, MADV_DONTNEED);
+    printf("Arrays allocated and initialized: %lu GB each in %lu ms\n", n_gb, (now_ns() - start_time) / 1000000);
     return 0;
 }
 
-static int verify_copy(void)
+/**
+ * Compare blocks [first, last) of array1 and array2, skipping blocks that
+ * are not in the current sample. Stores the offset of the first mismatch or
+ * leaves *mismatch untouched.
+ */
+static void verify_blocks(unsigned long first, unsigned long last, unsigned long seed,
+                          unsigned long *mismatch)
 {
     unsigned long size = GB_TO_BYTES(n_gb);
-    unsigned long i;
+    unsigned long nr_blocks = (size + VERIFY_BLOCK - 1) / VERIFY_BLOCK;
+    unsigned long b;
 
-    for (i = 0; i < size; i++)
+    for (b = first; b < last; b++)
     {
-        if (((char *)array1)[i] != ((char *)array2)[i])
+        unsigned long off = b * VERIFY_BLOCK;
+        unsigned long len = std::min((unsigned long)VERIFY_BLOCK, size - off);
+        size_t pos;
+
+        // the first and last block are always checked to catch off-by-one chunking
+        if (verify_sample > 1 && b != 0 && b != nr_blocks - 1 && mix64(b ^ seed) % verify_sample)
+            continue;
+
+        pos = find_mismatch((char *)array1 + off, (char *)array2 + off, len);
+        if (pos != len)
         {
-            printf("Verification failed at offset %lu, total size %lu, a1 %d a2 %d\n", i, size, ((char *)array1)[i], ((char *)array2)[i]);
-            verified = false;
-            return verified;
+            *mismatch = off + pos;
+            return;
         }
     }
+}
+
+static int verify_copy(void)
+{
+    unsigned long size = GB_TO_BYTES(n_gb);
+    unsigned long nr_blocks = (size + VERIFY_BLOCK - 1) / VERIFY_BLOCK;
+    unsigned long seed = rand();
+    unsigned long i = size;
+    std::vector<unsigned long> mismatch;
+    std::vector<std::thread> threads;
+    cpu_set_t set;
+    unsigned long nr_threads = verify_threads;
+
+    if (nr_threads == 0)
+    {
+        sched_getaffinity(0, sizeof(set), &set);
+        nr_threads = CPU_COUNT(&set);
+    }
+    nr_threads = std::max(1UL, std::min(nr_threads, nr_blocks));
+
+    // every thread scans a contiguous range, the lowest reported offset is the first mismatch
+    mismatch.assign(nr_threads, size);
+    for (unsigned long t = 1; t < nr_threads; t++)
+    {
+        threads.emplace_back(verify_blocks, nr_blocks * t / nr_threads, nr_blocks * (t + 1) / nr_threads,
+                             seed, &mismatch[t]);
+    }
+    verify_blocks(0, nr_blocks / nr_threads, seed, &mismatch[0]);
+    for (auto &t : threads)
+        t.join();
+    for (auto m : mismatch)
+        i = std::min(i, m);
+
+    if (i != size)
+    {
+        printf("Verification failed at offset %lu, total size %lu, a1 %d a2 %d\n", i, size, ((char *)array1)[i], ((char *)array2)[i]);
+        verified = false;
+        return verified;
+    }
 
     // printf("Verification successful\n");
     verified = true;
     return verified;
 }
 
+/**
+ * Collect the WQs named by -w, or every enabled user WQ sysfs lists, and
+ * order them nearest the destination buffer (or the copying cpu) first.
+ */
 static void configure_dsa(void)
 {
-    const char *dsa_path = "/dev/dsa/wq0.1";
+    int node = dst_node != NUMA_NODE_ANY ? dst_node : cpu_node;
+    unsigned long batch = dsa_queue_batch, max_xfer = DSA_MAX_XFER;
+
     printf("Configuring DSA......\n");
-    dsa_wq = map_dsa_device(dsa_path);
-    if (dsa_wq == MAP_FAILED)
+    if (!dsa_wq_spec)
+        dsa_discover();
+    else
+    {
+        char *spec = strdup(dsa_wq_spec);
+        char *save = NULL;
+
+        for (char *tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+        {
+            if (!strncmp(tok, "soft", 4))
+                dsa_soft_add(tok[4] == ':' ? std::max(1, atoi(tok + 5)) : 1);
+            else
+                dsa_add_wq(tok);
+        }
+        free(spec);
+    }
+    if (dsa_nr_wqs == 0)
+    {
+        printf("No usable DSA work queue, DSA disabled\n");
+        return;
+    }
+
+    dsa_stripe_width = dsa_nr_wqs;
+    dsa_prefer_node(node);
+    // the queue round robins over the WQs, it has to fit the smallest limits
+    for (int i = 0; i < dsa_nr_wqs; i++)
+    {
+        batch = std::min(batch, dsa_wqs[i].max_batch);
+        max_xfer = std::min(max_xfer, dsa_wqs[i].max_xfer);
+    }
+    if (dsa_queue_init(&dsa_queue, dsa_queue_depth, batch, max_xfer) != 0)
     {
-        printf("map_dsa_device failed MAP_FAILED\n");
+        dsa_cleanup();
         return;
     }
 
-    printf("Configured work queue.\n");
+    if ((dsa_op_flags & IDXD_OP_FLAG_CC) && !dsa_cache_control_supported())
+    {
+        printf("Not every WQ supports cache control, DSA writes go to memory\n");
+        dsa_op_flags &= ~IDXD_OP_FLAG_CC;
+    }
+
+    printf("Configured %d work queues:\n", dsa_nr_wqs);
+    dsa_print_wqs();
+    printf("copy_dsa_queued keeps %lu descriptors in flight in batches of %lu.\n", dsa_queue.depth,
+           dsa_queue.batch_size);
 }
 
-static void copy_driver(copy_func_t copy_func)
+static unsigned long bandwidth_mbps(unsigned long bytes, unsigned long ns)
+{
+    if (ns == 0)
+        return 0;
+    // bytes / seconds, converted to MB/s by dividing by 1024*1024
+    return (unsigned long)((double)bytes * 1000000000.0 / ns / (1024 * 1024));
+}
+
+static std::mt19937_64 pattern_rng;
+
+/**
+ * Chunk indices for one pass, following access_pattern. Every pattern
+ * yields num_chunks copies, the non-permutation ones may repeat chunks.
+ */
+static unsigned long *build_chunk_order(unsigned long num_chunks)
+{
+    unsigned long *chunk_order;
+
+    // Allocate array for chunk order
+    chunk_order = (unsigned long *)malloc(sizeof(unsigned long) * num_chunks);
+    if (!chunk_order)
+    {
+        printf("Failed to allocate chunk order array\n");
+        return NULL;
+    }
+
+    pattern_rng.seed(rand());
+    generate_pattern(access_pattern, chunk_order, num_chunks, pattern_rng);
+    return chunk_order;
+}
+
+/**
+ * Verify after a pass over chunk_order. Permutations cover the whole buffer;
+ * for the others only chunks that were copied are compared.
+ */
+static int verify_pattern_copy(const unsigned long *chunk_order, unsigned long num_chunks,
+                               unsigned long chunk_size)
+{
+    std::vector<bool> touched;
+    unsigned long i;
+
+    if (pattern_is_permutation(access_pattern))
+        return verify_copy();
+
+    touched.assign(num_chunks, false);
+    for (i = 0; i < num_chunks; i++)
+        touched[chunk_order[i]] = true;
+
+    for (i = 0; i < num_chunks; i++)
+    {
+        unsigned long offset = i * chunk_size;
+        size_t pos;
+
+        if (!touched[i])
+            continue;
+        pos = find_mismatch((char *)array1 + offset, (char *)array2 + offset, chunk_size);
+        if (pos != chunk_size)
+        {
+            printf("Verification failed at offset %lu, chunk %lu\n", offset + pos, i);
+            verified = false;
+            return verified;
+        }
+    }
+    verified = true;
+    return verified;
+}
+
+/**
+ * Copy the whole buffer once in shuffled chunk order and verify it.
+ * Updates last_copy_time_ns and last_bandwidth_mbps.
+ *
+ * @return
+ *   0 on success, -1 when the buffers or the chunk order cannot be set up.
+ */
+static int random_copy(copy_func_t copy_func, unsigned long chunk_size)
 {
     unsigned long total_size = GB_TO_BYTES(n_gb);
+    unsigned long num_chunks;
+    unsigned long *chunk_order;
+    unsigned long i;
+    unsigned long start_time, end_time;
+
+    if (allocate_and_initialize_arrays() != 0)
+        return -1;
+
+    num_chunks = total_size / chunk_size;
+    chunk_order = build_chunk_order(num_chunks);
+    if (!chunk_order)
+        return -1;
+
+    dsa_fault_stats_reset();
+    perf_counters_start();
+    // Start timing
+    start_time = now_ns();
+    // Perform copies in random order
+    for (i = 0; i < num_chunks; i++)
+    {
+        unsigned long offset = chunk_order[i] * chunk_size;
+        copy_func((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+    }
+    if (copy_drain)
+        copy_drain();
+    // End timing
+    end_time = now_ns();
+    perf_counters_stop();
+
+    // Calculate time taken and bandwidth
+    last_copy_time_ns = end_time - start_time;
+    last_bandwidth_mbps = bandwidth_mbps(total_size, last_copy_time_ns);
+
+    if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+    {
+        printf("Random copy verification failed  ns\n");
+        // avx_last_bandwidth_mbps = 99999999999;
+    }
+    free(chunk_order);
+    return 0;
+}
+
+static void copy_driver(copy_func_t copy_func)
+{
     unsigned long chunk_size;
+
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        if (random_copy(copy_func, chunk_size) != 0)
+            return;
+        printf("%lu KB\t\t%lu ms\t\t%lu MB/s\n", chunk_size / KB, last_copy_time_ns / 1000000, last_bandwidth_mbps);
+        dsa_fault_stats_print();
+        perf_counters_print(GB_TO_BYTES(n_gb));
+    }
+}
+
+/**
+ * Fill the whole destination once in chunk order with the byte array1 was
+ * initialized with, so the regular copy verification applies. Updates
+ * last_copy_time_ns and last_bandwidth_mbps.
+ *
+ * @return
+ *   0 on success, -1 when the buffers or the chunk order cannot be set up.
+ */
+static int random_fill(fill_func_t fill_func, unsigned long chunk_size)
+{
+    unsigned long total_size = GB_TO_BYTES(n_gb);
     unsigned long num_chunks;
     unsigned long *chunk_order;
     unsigned long i;
-    struct timespec t1;
     unsigned long start_time, end_time;
 
+    if (allocate_and_initialize_arrays() != 0)
+        return -1;
+
+    num_chunks = total_size / chunk_size;
+    chunk_order = build_chunk_order(num_chunks);
+    if (!chunk_order)
+        return -1;
+
+    dsa_fault_stats_reset();
+    perf_counters_start();
+    start_time = now_ns();
+    for (i = 0; i < num_chunks; i++)
+        fill_func((char *)array2 + chunk_order[i] * chunk_size, 1, chunk_size);
+    end_time = now_ns();
+    perf_counters_stop();
+
+    last_copy_time_ns = end_time - start_time;
+    last_bandwidth_mbps = bandwidth_mbps(total_size, last_copy_time_ns);
+
+    if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+        printf("Random fill verification failed\n");
+    free(chunk_order);
+    return 0;
+}
+
+static void fill_driver(fill_func_t fill_func)
+{
+    unsigned long chunk_size;
+
     for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
     {
-        allocate_and_initialize_arrays();
+        if (random_fill(fill_func, chunk_size) != 0)
+            return;
+        printf("%lu KB\t\t%lu ms\t\t%lu MB/s\n", chunk_size / KB, last_copy_time_ns / 1000000, last_bandwidth_mbps);
+        dsa_fault_stats_print();
+        perf_counters_print(GB_TO_BYTES(n_gb));
+    }
+}
+
+struct copy_worker
+{
+    int cpu;
+    unsigned long first; // index range into chunk_order
+    unsigned long last;
+    unsigned long start_ns;
+    unsigned long end_ns;
+};
+
+static void copy_worker_run(struct copy_worker *w, copy_func_t copy_func,
+                            const unsigned long *chunk_order, unsigned long chunk_size,
+                            pthread_barrier_t *barrier)
+{
+    unsigned long i;
+
+    // pinned before the barrier, no chunk is copied from the wrong cpu
+    pin_thread_to_cpu(pthread_self(), w->cpu);
+    pthread_barrier_wait(barrier);
+    w->start_ns = now_ns();
+    for (i = w->first; i < w->last; i++)
+    {
+        unsigned long offset = chunk_order[i] * chunk_size;
+        copy_func((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+    }
+    w->end_ns = now_ns();
+}
+
+/**
+ * Split chunk_order into equal contiguous slices, one per cpu in the list,
+ * and copy them concurrently from threads pinned to those cpus.
+ *
+ * @return
+ *   Wall time in ns from the earliest worker start to the latest worker end.
+ */
+static unsigned long run_threaded_copy(copy_func_t copy_func, const int *cpus, int nr_threads,
+                                       const unsigned long *chunk_order, unsigned long num_chunks,
+                                       unsigned long chunk_size, std::vector<struct copy_worker> &workers)
+{
+    std::vector<std::thread> threads;
+    pthread_barrier_t barrier;
+    unsigned long first_start = ~0UL, last_end = 0;
+    int t;
+
+    workers.assign(nr_threads, copy_worker());
+    pthread_barrier_init(&barrier, NULL, nr_threads);
+    for (t = 0; t < nr_threads; t++)
+    {
+        workers[t].cpu = cpus[t];
+        workers[t].first = num_chunks * t / nr_threads;
+        workers[t].last = num_chunks * (t + 1) / nr_threads;
+        threads.emplace_back(copy_worker_run, &workers[t], copy_func, chunk_order, chunk_size, &barrier);
+    }
+    for (t = 0; t < nr_threads; t++)
+    {
+        threads[t].join();
+        first_start = std::min(first_start, workers[t].start_ns);
+        last_end = std::max(last_end, workers[t].end_ns);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return last_end - first_start;
+}
+
+static void thread_scaling_driver(copy_func_t copy_func)
+{
+    static const struct
+    {
+        bool smt;
+        bool spread;
+        const char *name;
+    } placements[] = {
+        {false, false, "nosmt/same-socket"},
+        {true, false, "smt/same-socket"},
+        {false, true, "nosmt/spread"},
+        {true, true, "smt/spread"},
+    };
+    unsigned long total_size = GB_TO_BYTES(n_gb);
+    unsigned long chunk_size;
+    unsigned long num_chunks;
+    unsigned long *chunk_order;
+    std::vector<struct copy_worker> workers;
+    int cpus[MAX_CPUS];
+    size_t p;
 
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
         num_chunks = total_size / chunk_size;
-        // Allocate array for random chunk order
-        chunk_order = (unsigned long *)malloc(sizeof(unsigned long) * num_chunks);
+        chunk_order = build_chunk_order(num_chunks);
         if (!chunk_order)
-        {
-            printf("Failed to allocate chunk order array\n");
             return;
+
+        for (p = 0; p < sizeof(placements) / sizeof(placements[0]); p++)
+        {
+            int nr_cpus = cpu_placement(placements[p].smt, placements[p].spread, cpus,
+                                        max_threads > 0 ? max_threads : MAX_CPUS);
+            int nr_threads = 0;
+
+            // 1, 2, 4, ... and finally every cpu of the placement
+            while (nr_threads < nr_cpus)
+            {
+                unsigned long wall_ns;
+                unsigned long min_mbps = ~0UL, max_mbps = 0, sum_mbps = 0;
+
+                nr_threads = std::min(nr_threads ? nr_threads * 2 : 1, nr_cpus);
+                allocate_and_initialize_arrays();
+                wall_ns = run_threaded_copy(copy_func, cpus, nr_threads, chunk_order, num_chunks, chunk_size, workers);
+                if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+                {
+                    printf("Threaded copy verification failed\n");
+                }
+
+                printf("%lu KB\t%-18s\t%d threads\t%lu ms\t\t%lu MB/s aggregate",
+                       chunk_size / KB, placements[p].name, nr_threads, wall_ns / 1000000,
+                       bandwidth_mbps(total_size, wall_ns));
+                for (auto &w : workers)
+                {
+                    unsigned long mbps = bandwidth_mbps((w.last - w.first) * chunk_size, w.end_ns - w.start_ns);
+                    min_mbps = std::min(min_mbps, mbps);
+                    max_mbps = std::max(max_mbps, mbps);
+                    sum_mbps += mbps;
+                }
+                printf("\tper-thread min/avg/max %lu/%lu/%lu MB/s\n",
+                       min_mbps, sum_mbps / nr_threads, max_mbps);
+                for (auto &w : workers)
+                {
+                    printf("\t\tcpu %d: %lu MB/s\n", w.cpu,
+                           bandwidth_mbps((w.last - w.first) * chunk_size, w.end_ns - w.start_ns));
+                }
+            }
         }
+        free(chunk_order);
+    }
+}
+
+/**
+ * Repeat the chunk size sweep for every access pattern. Bandwidth counts the
+ * bytes copied, which for zipf/mixed includes repeated copies of hot chunks.
+ */
+static void pattern_driver(copy_func_t copy_func)
+{
+    enum access_pattern saved_pattern = access_pattern;
+    unsigned long chunk_size;
+    int nr_sizes = 0;
+    int p, c;
+    std::vector<unsigned long> result;
+
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+        nr_sizes++;
+    result.assign(nr_sizes * PATTERN_MAX, 0);
 
-        // Initialize chunk order
-        for (i = 0; i < num_chunks; i++)
+    for (p = 0; p < PATTERN_MAX; p++)
+    {
+        access_pattern = (enum access_pattern)p;
+        for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
         {
-            chunk_order[i] = i;
+            if (random_copy(copy_func, chunk_size) != 0)
+                break;
+            result[c * PATTERN_MAX + p] = last_bandwidth_mbps;
         }
+    }
+    access_pattern = saved_pattern;
+
+    printf("MB/s");
+    for (p = 0; p < PATTERN_MAX; p++)
+        printf("\t\t%s", pattern_names[p]);
+    printf("\n");
+    for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
+    {
+        printf("%lu KB", chunk_size / KB);
+        for (p = 0; p < PATTERN_MAX; p++)
+            printf("\t\t%lu", result[c * PATTERN_MAX + p]);
+        printf("\n");
+    }
+}
+
+/**
+ * One pass like random_copy with every chunk shifted by src_off bytes in
+ * array1 and dst_off bytes in array2. The last chunk is left out so the
+ * shifted chunks stay inside the buffers.
+ *
+ * @return
+ *   bandwidth in MB/s, -1 when the buffers or the chunk order cannot be set up.
+ */
+static long align_copy(copy_func_t copy_func, unsigned long chunk_size, unsigned long src_off,
+                       unsigned long dst_off)
+{
+    unsigned long num_chunks = GB_TO_BYTES(n_gb) / chunk_size - 1;
+    unsigned long *chunk_order;
+    unsigned long i;
+    unsigned long start_time, end_time;
+    std::vector<bool> touched(num_chunks, false);
+
+    if (allocate_and_initialize_arrays() != 0)
+        return -1;
+    chunk_order = build_chunk_order(num_chunks);
+    if (!chunk_order)
+        return -1;
+
+    start_time = now_ns();
+    for (i = 0; i < num_chunks; i++)
+    {
+        unsigned long offset = chunk_order[i] * chunk_size;
+        copy_func((char *)array2 + offset + dst_off, (char *)array1 + offset + src_off, chunk_size);
+    }
+    end_time = now_ns();
+
+    for (i = 0; i < num_chunks; i++)
+        touched[chunk_order[i]] = true;
+    free(chunk_order);
+
+    verified = true;
+    for (i = 0; i < num_chunks && verified; i++)
+    {
+        unsigned long offset = i * chunk_size;
+        size_t pos;
 
-        // Shuffle chunk order
-        for (i = num_chunks - 1; i > 0; i--)
+        if (!touched[i])
+            continue;
+        pos = find_mismatch((char *)array1 + offset + src_off, (char *)array2 + offset + dst_off, chunk_size);
+        if (pos != chunk_size)
         {
-            unsigned long j = rand() % (i + 1);
-            unsigned long temp = chunk_order[i];
-            chunk_order[i] = chunk_order[j];
-            chunk_order[j] = temp;
+            printf("Alignment copy verification failed at chunk %lu byte %lu (src +%lu, dst +%lu)\n",
+                   i, (unsigned long)pos, src_off, dst_off);
+            verified = false;
         }
+    }
+    return bandwidth_mbps(num_chunks * chunk_size, end_time - start_time);
+}
 
-        // Start timing
-        clock_gettime(CLOCK_REALTIME, &t1);
-        start_time = t1.tv_sec * 1000000000 + t1.tv_nsec;
-        // Perform copies in random order
-        for (i = 0; i < num_chunks; i++)
+/**
+ * Bandwidth with only the source, only the destination and both buffers
+ * misaligned by 0..63 bytes in align_step increments. Cache-line splits on
+ * the loads and on the stores cost differently, so the columns diverge.
+ */
+static void align_driver(copy_func_t copy_func)
+{
+    unsigned long chunk_size, off;
+
+    printf("chunk\t\toffset\tsrc\tdst\tboth (MB/s)\n");
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        for (off = 0; off <= ALIGNMENT_MASK; off += align_step)
         {
-            unsigned long offset = chunk_order[i] * chunk_size;
-            copy_func((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+            long src = align_copy(copy_func, chunk_size, off, 0);
+            long dst = align_copy(copy_func, chunk_size, 0, off);
+            long both = align_copy(copy_func, chunk_size, off, off);
+
+            if (src < 0 || dst < 0 || both < 0)
+                return;
+            printf("%lu KB\t\t%lu\t%ld\t%ld\t%ld\n", chunk_size / KB, off, src, dst, both);
         }
-        // End timing
-        clock_gettime(CLOCK_REALTIME, &t1);
-        end_time = t1.tv_sec * 1000000000 + t1.tv_nsec;
+    }
+}
 
-        // Calculate time taken and bandwidth
-        last_copy_time_ns = end_time - start_time;
+static const unsigned long overlap_distances[] = {1, 8, 32, 63, 64, 256, 4096};
+#define OVERLAP_NR_DISTANCES (int)(sizeof(overlap_distances) / sizeof(overlap_distances[0]))
+#define OVERLAP_MAX_DISTANCE 4096
 
-        // Calculate bandwidth in MB/s
-        // total_size in bytes / time in seconds = bytes per second
-        // Convert to MB/s by dividing by 1024*1024
-        last_bandwidth_mbps = (unsigned long)total_size * 1000000000ULL / last_copy_time_ns;
-        last_bandwidth_mbps = last_bandwidth_mbps / (1024 * 1024);
+/**
+ * Move chunk_size bytes inside every slot of array2 by distance bytes,
+ * towards higher addresses when backward is set and towards lower ones
+ * otherwise. array2 starts as a copy of array1, which then serves as the
+ * reference for verification. array1 holds the position pattern outside
+ * fill mode, so a move in the wrong direction or by the wrong distance
+ * does not match it.
+ *
+ * @return
+ *   bandwidth in MB/s, -1 when the buffers or the chunk order cannot be set up.
+ */
+static long overlap_move(copy_func_t move_func, unsigned long chunk_size, unsigned long distance, bool backward)
+{
+    unsigned long slot = chunk_size + OVERLAP_MAX_DISTANCE;
+    unsigned long num_slots = GB_TO_BYTES(n_gb) / slot;
+    unsigned long src_off = backward ? 0 : distance;
+    unsigned long dst_off = backward ? distance : 0;
+    unsigned long *slot_order;
+    unsigned long i;
+    unsigned long start_time, end_time;
 
-        free(chunk_order);
-        if (verify_copy() != true)
+    if (allocate_and_initialize_arrays() != 0)
+        return -1;
+    memcpy(array2, array1, num_slots * slot);
+    // the order is a permutation whatever -a says, every slot must move exactly once
+    slot_order = (unsigned long *)malloc(sizeof(unsigned long) * num_slots);
+    if (!slot_order)
+    {
+        printf("Failed to allocate chunk order array\n");
+        return -1;
+    }
+    pattern_rng.seed(rand());
+    generate_pattern(PATTERN_RANDOM, slot_order, num_slots, pattern_rng);
+
+    start_time = now_ns();
+    for (i = 0; i < num_slots; i++)
+    {
+        char *base = (char *)array2 + slot_order[i] * slot;
+        move_func(base + dst_off, base + src_off, chunk_size);
+    }
+    end_time = now_ns();
+    free(slot_order);
+
+    verified = true;
+    for (i = 0; i < num_slots; i++)
+    {
+        unsigned long offset = i * slot;
+        size_t pos = find_mismatch((char *)array1 + offset + src_off, (char *)array2 + offset + dst_off, chunk_size);
+
+        if (pos != chunk_size)
         {
-            printf("Random copy verification failed  ns\n");
-            // avx_last_bandwidth_mbps = 99999999999;
+            printf("Overlap move verification failed at slot %lu byte %lu (distance %lu, %s)\n",
+                   i, (unsigned long)pos, distance, backward ? "backward" : "forward");
+            verified = false;
+            break;
         }
-        printf("%lu KB\t\t%lu ms\t\t%lu MB/s\n", chunk_size / KB, last_copy_time_ns / 1000000, last_bandwidth_mbps);
     }
+    return bandwidth_mbps(num_slots * chunk_size, end_time - start_time);
 }
 
-int main(void)
+/**
+ * memmove bandwidth against the distance between overlapping source and
+ * destination. Short distances put loads right behind (forward) or ahead
+ * of (backward) stores still in flight, which some cores handle poorly.
+ */
+static void overlap_driver(copy_func_t move_func)
 {
-    allocate_and_initialize_arrays();
-    configure_dsa();
+    unsigned long chunk_size;
+
+    printf("chunk\t\tdistance\tforward\tbackward (MB/s)\n");
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        for (int i = 0; i < OVERLAP_NR_DISTANCES; i++)
+        {
+            long fwd = overlap_move(move_func, chunk_size, overlap_distances[i], false);
+            long bwd = overlap_move(move_func, chunk_size, overlap_distances[i], true);
+
+            if (fwd < 0 || bwd < 0)
+                return;
+            printf("%lu KB\t\t%lu\t\t%ld\t%ld\n", chunk_size / KB, overlap_distances[i], fwd, bwd);
+        }
+    }
+}
+
+/**
+ * Aggregate bandwidth of a striping variant as it spreads over more WQs,
+ * nearest WQs first.
+ */
+static void wq_scaling_driver(copy_func_t copy_func)
+{
+    int saved_width = dsa_stripe_width;
+    unsigned long chunk_size;
+
+    printf("WQs\tchunk\t\tms\tMB/s\n");
+    for (dsa_stripe_width = 1; dsa_stripe_width <= dsa_nr_wqs; dsa_stripe_width++)
+    {
+        for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+        {
+            if (random_copy(copy_func, chunk_size) != 0)
+                break;
+            printf("%d\t%lu KB\t\t%lu\t%lu\n", dsa_stripe_width, chunk_size / KB, last_copy_time_ns / 1000000,
+                   last_bandwidth_mbps);
+        }
+    }
+    dsa_stripe_width = saved_width;
+}
+
+/**
+ * Time every copy_func call with the TSC and report latency percentiles next
+ * to the aggregate bandwidth. Chunks below LATENCY_BATCH_BYTES are timed in
+ * batches and every call of a batch is recorded with the batch average.
+ */
+static void latency_driver(copy_func_t copy_func)
+{
+    static struct latency_hist hist;
+    unsigned long total_size = GB_TO_BYTES(n_gb);
+    unsigned long chunk_size;
+    unsigned long num_chunks;
+    unsigned long *chunk_order;
+    unsigned long i, j;
+    unsigned long start_time, end_time;
+
+    printf("chunk\t\tMB/s\tp50\tp90\tp99\tp99.9\tmax (ns)\n");
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        unsigned long batch = chunk_size >= LATENCY_BATCH_BYTES ? 1 : LATENCY_BATCH_BYTES / chunk_size;
+
+        if (allocate_and_initialize_arrays() != 0)
+            return;
+        num_chunks = total_size / chunk_size;
+        chunk_order = build_chunk_order(num_chunks);
+        if (!chunk_order)
+            return;
+        hist_reset(&hist);
+
+        start_time = now_ns();
+        for (i = 0; i < num_chunks; i += batch)
+        {
+            unsigned long n = std::min(batch, num_chunks - i);
+            uint64_t t0, t1, cycles;
+
+            t0 = tsc_begin();
+            for (j = i; j < i + n; j++)
+            {
+                unsigned long offset = chunk_order[j] * chunk_size;
+                copy_func((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+            }
+            t1 = tsc_end();
+            cycles = t1 - t0 > tsc_overhead ? t1 - t0 - tsc_overhead : 0;
+            hist_record(&hist, tsc_to_ns(cycles) / n, n);
+        }
+        end_time = now_ns();
+
+        if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+        {
+            printf("Latency copy verification failed\n");
+        }
+        free(chunk_order);
+        printf("%lu KB%s\t\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", chunk_size / KB, batch > 1 ? "*" : "",
+               bandwidth_mbps(total_size, end_time - start_time),
+               hist_percentile(&hist, 50), hist_percentile(&hist, 90), hist_percentile(&hist, 99),
+               hist_percentile(&hist, 99.9), hist.max);
+    }
+    printf("(* batched: each call recorded as the average of %lu bytes worth of calls)\n", (unsigned long)LATENCY_BATCH_BYTES);
+}
+
+/**
+ * Time every dispatch implementation over a range of copy sizes, pick the
+ * winner per size and write the resulting size classes as a tuning profile.
+ * A new class only starts where another implementation beats the current
+ * one by more than 5%, so measurement noise does not fragment the profile.
+ */
+static void calibrate_driver(void)
+{
+    unsigned long total_size = GB_TO_BYTES(n_gb);
+    std::vector<unsigned long> offsets;
+    std::vector<size_t> sizes;
+    struct dispatch_class classes[DISPATCH_MAX_CLASSES];
+    int nr_classes = 0;
+    char brand[49];
+    size_t size;
+    int i;
+
+    // powers of two and the midpoints between them: 16, 24, 32, 48, 64, ...
+    for (size = 16; size <= (size_t)block_size_max; size *= 2)
+    {
+        sizes.push_back(size);
+        if (size + size / 2 <= (size_t)block_size_max)
+            sizes.push_back(size + size / 2);
+    }
+
+    printf("size");
+    for (i = 0; i < dispatch_nr_impls; i++)
+        printf("\t%s", dispatch_impls[i].name);
+    printf("\t(MB/s)\n");
+
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+        size = sizes[s];
+        unsigned long num_chunks = total_size / size;
+        unsigned long copies = std::max(calibrate_bytes / size, 1024UL);
+        std::vector<unsigned long> mbps(dispatch_nr_impls);
+        unsigned long j;
+        int best = 0, current = -1;
+
+        offsets.resize(copies);
+        for (j = 0; j < copies; j++)
+            offsets[j] = (rand() % num_chunks) * size;
+
+        for (i = 0; i < dispatch_nr_impls; i++)
+        {
+            copy_func_t func = dispatch_impls[i].func;
+            unsigned long start_time = now_ns();
+
+            for (j = 0; j < copies; j++)
+                func((char *)array2 + offsets[j], (char *)array1 + offsets[j], size);
+            mbps[i] = bandwidth_mbps(copies * size, now_ns() - start_time);
+            if (mbps[i] > mbps[best])
+                best = i;
+        }
+
+        printf("%zu", size);
+        for (i = 0; i < dispatch_nr_impls; i++)
+            printf("\t%lu", mbps[i]);
+        printf("\n");
+
+        if (nr_classes > 0)
+            current = dispatch_find_impl(classes[nr_classes - 1].impl.name) - dispatch_impls;
+        if (current >= 0 && mbps[best] * 100 <= mbps[current] * 105)
+            continue;
+        if (nr_classes == DISPATCH_MAX_CLASSES)
+        {
+            printf("too many size classes, profile truncated at %zu bytes\n", size);
+            break;
+        }
+        classes[nr_classes] = {nr_classes == 0 ? 0 : size, dispatch_impls[best]};
+        nr_classes++;
+    }
+
+    memcpy(dispatch_classes, classes, sizeof(classes[0]) * nr_classes);
+    dispatch_nr_classes = nr_classes;
+    dispatch_print();
+
+    cpu_brand_string(brand);
+    if (dispatch_save_profile(profile_out, brand) == 0)
+        printf("Tuning profile written to %s\n", profile_out);
+}
+
+/**
+ * Runtime sized counterparts of fixed_bench_avx2/avx512. noinline keeps the
+ * size from being propagated as a constant into the copy.
+ */
+__attribute__((noinline)) TARGET_AVX512 static void runtime_bench_rte(uint8_t *d, const uint8_t *s, size_t stride,
+                                                                    unsigned long window, unsigned long iters, size_t n)
+{
+    for (unsigned long i = 0; i < iters; i++)
+    {
+        size_t off = (i & (window - 1)) * stride;
+        rte_memcpy(d + off, s + off, n);
+    }
+}
+
+__attribute__((noinline)) static void runtime_bench_memcpy(uint8_t *d, const uint8_t *s, size_t stride,
+                                                         unsigned long window, unsigned long iters, size_t n)
+{
+    for (unsigned long i = 0; i < iters; i++)
+    {
+        size_t off = (i & (window - 1)) * stride;
+        memcpy(d + off, s + off, n);
+    }
+}
+
+/**
+ * Time FIXED_ITERS calls of func copying n bytes, after one warm-up pass
+ * over the window, then check every slot of the window.
+ */
+static double fixed_time(fixed_bench_func_t func, size_t n)
+{
+    uint8_t *d = (uint8_t *)array2;
+    const uint8_t *s = (const uint8_t *)array1;
+    unsigned long start_time, end_time;
+
+    memset(d, 0, FIXED_WINDOW * FIXED_STRIDE);
+    func(d, s, FIXED_STRIDE, FIXED_WINDOW, FIXED_WINDOW, n);
+    start_time = now_ns();
+    func(d, s, FIXED_STRIDE, FIXED_WINDOW, FIXED_ITERS, n);
+    end_time = now_ns();
+
+    for (unsigned long i = 0; i < FIXED_WINDOW; i++)
+    {
+        if (find_mismatch(s + i * FIXED_STRIDE, d + i * FIXED_STRIDE, n) != n)
+        {
+            printf("Fixed size copy verification failed for N = %lu\n", (unsigned long)n);
+            break;
+        }
+    }
+    return (double)(end_time - start_time) / FIXED_ITERS;
+}
+
+/**
+ * Per-call ns of copy_fixed<N> against rte_memcpy and memcpy given the same
+ * N at run time. All copies stay inside a cache resident window, so the
+ * difference is the cost of deciding how to copy rather than of moving data.
+ */
+static void fixed_driver(void)
+{
+    size_t n;
+
+    printf("N\tfixed_avx2\tfixed_avx512\trte_memcpy\tmemcpy (ns/call)\n");
+    for (n = 1; n <= FIXED_COPY_MAX; n++)
+    {
+        printf("%lu", (unsigned long)n);
+        if (cpu_features.avx2)
+            printf("\t%.2f", fixed_time(fixed_bench_avx2_funcs[n], n));
+        else
+            printf("\tn/a");
+        if (cpu_features.avx512)
+        {
+            printf("\t\t%.2f", fixed_time(fixed_bench_avx512_funcs[n], n));
+            printf("\t\t%.2f", fixed_time(runtime_bench_rte, n));
+        }
+        else
+            printf("\t\tn/a\t\tn/a");
+        printf("\t\t%.2f\n", fixed_time(runtime_bench_memcpy, n));
+    }
+}
+
+static unsigned long thread_cpu_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+/**
+ * Latency of copy_dsa() under every wait strategy, and what the waiting
+ * costs per copy: wait is the time spent in poll_completion(), cpu the
+ * thread's cpu time, which yield gives back, and with -e cycles the
+ * unhalted user cycles, which UMWAIT and TPAUSE do not burn either.
+ */
+static void wait_driver(void)
+{
+    static struct latency_hist hist;
+    enum dsa_wait_mode saved_mode = dsa_wait_mode;
+    unsigned long total_size = GB_TO_BYTES(n_gb);
+
+    if (!dsa_wq)
+    {
+        printf("wait mode needs a DSA WQ, see -w\n");
+        return;
+    }
+    if (!cpu_features.waitpkg)
+        printf("cpu lacks WAITPKG, umwait and tpause skipped\n");
+
+    printf("chunk\t\twait\tMB/s\tp50\tp99\twait\tcpu\tcycles (ns, cycles per copy)\n");
+    for (unsigned long chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        for (int m = 0; m < DSA_WAIT_MODES; m++)
+        {
+            unsigned long num_chunks = total_size / chunk_size;
+            unsigned long *chunk_order;
+            unsigned long start_time, end_time, cpu_time;
+
+            if ((m == DSA_WAIT_UMWAIT || m == DSA_WAIT_TPAUSE) && !cpu_features.waitpkg)
+                continue;
+            dsa_wait_mode = (enum dsa_wait_mode)m;
+            if (allocate_and_initialize_arrays() != 0)
+                return;
+            chunk_order = build_chunk_order(num_chunks);
+            if (!chunk_order)
+                return;
+            hist_reset(&hist);
+            dsa_wait_cycles = 0;
+
+            cpu_time = thread_cpu_ns();
+            perf_counters_start();
+            start_time = now_ns();
+            for (unsigned long i = 0; i < num_chunks; i++)
+            {
+                unsigned long offset = chunk_order[i] * chunk_size;
+                uint64_t t0, t1;
+
+                t0 = tsc_begin();
+                copy_dsa((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+                t1 = tsc_end();
+                hist_record(&hist, tsc_to_ns(t1 - t0 > tsc_overhead ? t1 - t0 - tsc_overhead : 0));
+            }
+            end_time = now_ns();
+            perf_counters_stop();
+            cpu_time = thread_cpu_ns() - cpu_time;
+
+            if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+                printf("Wait copy verification failed\n");
+            free(chunk_order);
+            printf("%lu KB\t\t%s\t%lu\t%lu\t%lu\t%lu\t%lu\t", chunk_size / KB, dsa_wait_names[m],
+                   bandwidth_mbps(total_size, end_time - start_time), hist_percentile(&hist, 50),
+                   hist_percentile(&hist, 99), tsc_to_ns(dsa_wait_cycles) / num_chunks, cpu_time / num_chunks);
+            if (perf_enabled && perf_valid[0])
+                printf("%lu\n", (unsigned long)perf_values[0] / num_chunks);
+            else
+                printf("n/a\n");
+        }
+    }
+    dsa_wait_mode = saved_mode;
+}
+
+static std::atomic<unsigned long> consume_posted; // chunks handed to the consumer
+static std::atomic<unsigned long> consume_done;   // chunks it finished reading
+static const uint64_t *consume_buf;
+static size_t consume_len;
+static uint64_t consume_cycles; // TSC cycles the consumer spent reading
+static uint64_t consume_sum;
+static bool consume_yield;      // the consumer shares a single cpu with the producer
+
+static inline void consume_pause(void)
+{
+    if (consume_yield)
+        sched_yield();
+    else
+        _mm_pause();
+}
+
+/**
+ * Read every chunk posted, sum it so the loads are not dropped, and report
+ * back through consume_done. Pins itself to cpu first, unless it is -1.
+ */
+static void consume_thread(int cpu)
+{
+    unsigned long seen = 0;
+
+    if (cpu >= 0)
+        pin_thread_to_cpu(pthread_self(), cpu);
+
+    for (;;)
+    {
+        unsigned long posted;
+        uint64_t t0, sum = 0;
+
+        while ((posted = consume_posted.load(std::memory_order_acquire)) == seen)
+            consume_pause();
+        if (posted == CONSUME_STOP)
+            return;
+        t0 = tsc_begin();
+        for (size_t i = 0; i < consume_len / 8; i++)
+            sum += consume_buf[i];
+        consume_cycles += tsc_end() - t0;
+        consume_sum += sum;
+        seen = posted;
+        consume_done.store(seen, std::memory_order_release);
+    }
+}
+
+/**
+ * Pick the cpus of consume mode: the first core of the first socket for
+ * the producer and, for the consumer, another core of that socket so both
+ * share its LLC but not a core's private caches. A socket with a single
+ * core falls back to the producer's SMT sibling, a single cpu to the
+ * producer's own.
+ *
+ * @return
+ *   0, or -1 when the topology is unknown and nothing is pinned.
+ */
+static int consume_placement(int *producer, int *consumer)
+{
+    int cpus[MAX_CPUS];
+    int nr_cpus;
+
+    if (cpu_topology_count <= 0 && cpu_topology_init() <= 0)
+        return -1;
+    for (int smt = 0; smt < 2; smt++)
+    {
+        nr_cpus = cpu_placement(smt, false, cpus, MAX_CPUS);
+        if (nr_cpus <= 0)
+            continue;
+        *producer = *consumer = cpus[0];
+        if (nr_cpus > 1 && cpu_package(cpus[1]) == cpu_package(cpus[0]))
+        {
+            *consumer = cpus[1];
+            return 0;
+        }
+    }
+    return nr_cpus > 0 ? 0 : -1;
+}
+
+/**
+ * Producer/consumer handoff. This thread copies a chunk, a consumer thread
+ * then reads all of it and the next copy starts once it is done. DSA
+ * without cache control and the NT cpu copy leave the chunk in memory for
+ * the reader, DSA with IDXD_OP_FLAG_CC and the temporal cpu copy leave it
+ * in the cache. Per chunk: copy is the producer's time, consume the
+ * reader's, and total copy to last byte read including the handoff.
+ */
+static void consume_driver(void)
+{
+    struct
+    {
+        const char *name;
+        copy_func_t func;
+        uint32_t dsa_flags;
+        bool available;
+    } variants[] = {
+        {"dsa", copy_dsa, 0, dsa_wq != NULL},
+        {"dsa_cc", copy_dsa, IDXD_OP_FLAG_CC, dsa_wq && dsa_cache_control_supported()},
+        {"cpu", _avx_cpy_any, 0, cpu_features.avx2},
+        {"cpu_nt", _avx_async_cpy_any, 0, cpu_features.avx2},
+    };
+    uint32_t saved_flags = dsa_op_flags;
+    unsigned long total_size = GB_TO_BYTES(n_gb);
+    unsigned long seq = 0;
+    int producer_cpu, consumer_cpu = -1;
+    cpu_set_t set;
+    std::thread consumer;
+
+    if (consume_placement(&producer_cpu, &consumer_cpu) == 0)
+    {
+        pin_thread_to_cpu(pthread_self(), producer_cpu);
+        consume_yield = producer_cpu == consumer_cpu;
+        printf("Producer on cpu %d, consumer on cpu %d (package %d%s)\n", producer_cpu, consumer_cpu,
+               cpu_package(producer_cpu), consume_yield ? ", sharing the cpu" : "");
+    }
+    else
+    {
+        sched_getaffinity(0, sizeof(set), &set);
+        consume_yield = CPU_COUNT(&set) < 2;
+    }
+    consumer = std::thread(consume_thread, consumer_cpu);
+
+    printf("chunk\t\tengine\tMB/s\tcopy\tconsume\ttotal (ns per chunk)\n");
+    for (unsigned long chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        for (auto &v : variants)
+        {
+            unsigned long num_chunks = total_size / chunk_size;
+            unsigned long *chunk_order;
+            unsigned long start_time, end_time;
+            uint64_t copy_cycles = 0, total_cycles = 0;
+
+            if (!v.available)
+                continue;
+            dsa_op_flags = (saved_flags & ~IDXD_OP_FLAG_CC) | v.dsa_flags;
+            if (allocate_and_initialize_arrays() != 0)
+                break;
+            chunk_order = build_chunk_order(num_chunks);
+            if (!chunk_order)
+                break;
+            consume_cycles = 0;
+
+            start_time = now_ns();
+            for (unsigned long i = 0; i < num_chunks; i++)
+            {
+                unsigned long offset = chunk_order[i] * chunk_size;
+                uint64_t t0, t1;
+
+                t0 = tsc_begin();
+                v.func((char *)array2 + offset, (char *)array1 + offset, chunk_size);
+                t1 = tsc_end();
+                consume_buf = (const uint64_t *)((char *)array2 + offset);
+                consume_len = chunk_size;
+                consume_posted.store(++seq, std::memory_order_release);
+                while (consume_done.load(std::memory_order_acquire) != seq)
+                    consume_pause();
+                copy_cycles += t1 - t0;
+                total_cycles += tsc_end() - t0;
+            }
+            end_time = now_ns();
+
+            if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+                printf("Consume copy verification failed\n");
+            free(chunk_order);
+            printf("%lu KB\t\t%s\t%lu\t%lu\t%lu\t%lu\n", chunk_size / KB, v.name,
+                   bandwidth_mbps(total_size, end_time - start_time), tsc_to_ns(copy_cycles) / num_chunks,
+                   tsc_to_ns(consume_cycles) / num_chunks, tsc_to_ns(total_cycles) / num_chunks);
+        }
+    }
+    consume_posted.store(CONSUME_STOP, std::memory_order_release);
+    consumer.join();
+    dsa_op_flags = saved_flags;
+    if (!dsa_wq)
+        printf("no DSA WQ, only the cpu copies were measured\n");
+}
+
+static uint64_t async_work_sink;
+
+/**
+ * One unit of synthetic request work: a dependent multiply chain that stays
+ * in registers, so it competes with copies for the core but not for memory.
+ */
+static inline void async_work_unit(void)
+{
+    uint64_t x = async_work_sink;
+
+    for (int i = 0; i < ASYNC_WORK_ROUNDS; i++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    async_work_sink = x;
+}
+
+/**
+ * Copy chunk_order[first, last) one chunk at a time, suspending on each.
+ */
+static async_task async_copy_chunks(struct async_copy *h, enum async_backend backend, const unsigned long *chunk_order,
+                                    unsigned long first, unsigned long last, unsigned long chunk_size)
+{
+    for (unsigned long i = first; i < last; i++)
+    {
+        unsigned long offset = chunk_order[i] * chunk_size;
+
+        co_await copy_async(h, backend, (char *)array2 + offset, (char *)array1 + offset, chunk_size);
+    }
+}
+
+/**
+ * Time one pass over the buffer with backend. Without overlap the copies
+ * are waited for one after the other; with it ASYNC_INFLIGHT coroutines
+ * copy while this thread runs work units and polls between them.
+ *
+ * @return
+ *   Elapsed ns, or 0 when the buffers cannot be set up. *units receives
+ *   the work units done meanwhile.
+ */
+static unsigned long async_pass(enum async_backend backend, unsigned long chunk_size, bool overlap,
+                                unsigned long *units)
+{
+    unsigned long num_chunks = GB_TO_BYTES(n_gb) / chunk_size;
+    struct async_copy *handles[ASYNC_INFLIGHT];
+    std::vector<async_task> tasks;
+    unsigned long *chunk_order;
+    unsigned long start_time, elapsed;
+    bool running = true;
+
+    *units = 0;
+    if (allocate_and_initialize_arrays() != 0)
+        return 0;
+    chunk_order = build_chunk_order(num_chunks);
+    if (!chunk_order)
+        return 0;
+    for (int t = 0; t < ASYNC_INFLIGHT; t++)
+        handles[t] = async_copy_alloc();
+
+    start_time = now_ns();
+    if (!overlap)
+    {
+        for (unsigned long i = 0; i < num_chunks; i++)
+        {
+            unsigned long offset = chunk_order[i] * chunk_size;
+
+            async_copy_start(handles[0], backend, (char *)array2 + offset, (char *)array1 + offset, chunk_size);
+            async_copy_wait(handles[0]);
+        }
+    }
+    else
+    {
+        for (int t = 0; t < ASYNC_INFLIGHT; t++)
+            tasks.push_back(async_copy_chunks(handles[t], backend, chunk_order, num_chunks * t / ASYNC_INFLIGHT,
+                                              num_chunks * (t + 1) / ASYNC_INFLIGHT, chunk_size));
+        while (running)
+        {
+            async_work_unit();
+            (*units)++;
+            async_poll();
+            running = false;
+            for (auto &task : tasks)
+                running |= !task.coro.done();
+        }
+    }
+    elapsed = now_ns() - start_time;
+
+    for (auto &task : tasks)
+        task.coro.destroy();
+    for (int t = 0; t < ASYNC_INFLIGHT; t++)
+        async_copy_free(handles[t]);
+    if (verify_pattern_copy(chunk_order, num_chunks, chunk_size) != true)
+        printf("Async copy verification failed\n");
+    free(chunk_order);
+    return elapsed;
+}
+
+/**
+ * How much request work survives a bulk copy running underneath it. The
+ * work rate alone is measured first; each backend then copies the buffer
+ * once waiting on every copy, and once from coroutines while the work
+ * runs. "work" is the share of the work-alone rate kept during the
+ * overlapped pass.
+ */
+static void async_driver(void)
+{
+    enum async_backend backends[2];
+    int nr_backends = 0;
+    unsigned long start_time, units = 0;
+    double work_per_ns;
+
+    if (dsa_wq)
+        backends[nr_backends++] = ASYNC_DSA;
+    backends[nr_backends++] = ASYNC_CPU;
+    async_cpu_start(1);
+
+    start_time = now_ns();
+    while (now_ns() - start_time < 200000000UL)
+    {
+        async_work_unit();
+        units++;
+    }
+    work_per_ns = (double)units / (now_ns() - start_time);
+
+    printf("chunk		engine	copy ms	overlap ms	MB/s	work\n");
+    for (unsigned long chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+    {
+        for (int b = 0; b < nr_backends; b++)
+        {
+            unsigned long copy_ns = async_pass(backends[b], chunk_size, false, &units);
+            unsigned long overlap_ns = async_pass(backends[b], chunk_size, true, &units);
+
+            if (copy_ns == 0 || overlap_ns == 0)
+                break;
+            printf("%lu KB\t\t%s\t%lu\t%lu\t\t%lu\t%.0f%%\n", chunk_size / KB, async_backend_names[backends[b]],
+                   copy_ns / 1000000, overlap_ns / 1000000, bandwidth_mbps(GB_TO_BYTES(n_gb), overlap_ns),
+                   100.0 * units / (work_per_ns * overlap_ns));
+        }
+    }
+    async_cpu_stop();
+}
+
+static bool variant_selected(const char *name)
+{
+    const char *p = variant_filter;
+    size_t len = strlen(name);
+
+    if (!p)
+        return true;
+
+    while (*p)
+    {
+        size_t tok = strcspn(p, ",");
+        if (tok == len && !strncmp(p, name, len))
+            return true;
+        p += tok;
+        if (*p == ',')
+            p++;
+    }
+    return false;
+}
+
+/**
+ * Copy bandwidth for every (source node, destination node) pair with the
+ * copying thread on cpu_node, or on the source node when cpu_node is not set.
+ */
+static void numa_matrix_driver(copy_func_t copy_func)
+{
+    unsigned long chunk_size;
+    int nodes[MAX_NUMA_NODES];
+    int nr_nodes = numa_nodes(nodes, MAX_NUMA_NODES);
+    int nr_sizes = 0;
+    int s, d, c;
+    int saved_src = src_node, saved_dst = dst_node;
+    cpu_set_t saved_affinity;
+    std::vector<unsigned long> result;
+
+    sched_getaffinity(0, sizeof(saved_affinity), &saved_affinity);
+
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+        nr_sizes++;
+    result.assign(nr_sizes * nr_nodes * nr_nodes, 0);
+
+    for (s = 0; s < nr_nodes; s++)
+    {
+        for (d = 0; d < nr_nodes; d++)
+        {
+            cleanup_arrays();
+            src_node = nodes[s];
+            dst_node = nodes[d];
+            bind_thread_to_node(cpu_node != NUMA_NODE_ANY ? cpu_node : src_node);
+
+            for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
+            {
+                if (random_copy(copy_func, chunk_size) != 0)
+                    return;
+                result[(c * nr_nodes + s) * nr_nodes + d] = last_bandwidth_mbps;
+            }
+        }
+    }
+
+    // leave the arrays and thread as configured on the command line
+    cleanup_arrays();
+    src_node = saved_src;
+    dst_node = saved_dst;
+    sched_setaffinity(0, sizeof(saved_affinity), &saved_affinity);
+
+    for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
+    {
+        printf("%lu KB MB/s\tsrc\\dst", chunk_size / KB);
+        for (d = 0; d < nr_nodes; d++)
+            printf("\tnode%d", nodes[d]);
+        printf("\n");
+        for (s = 0; s < nr_nodes; s++)
+        {
+            printf("\t\tnode%d", nodes[s]);
+            for (d = 0; d < nr_nodes; d++)
+                printf("\t%lu", result[(c * nr_nodes + s) * nr_nodes + d]);
+            printf("\n");
+        }
+    }
+}
+
+/**
+ * Repeat the chunk size sweep for every page backing so the TLB share of the
+ * copy cost shows up as the difference between columns. Backings that cannot
+ * be allocated (no reserved hugetlb pages) are reported as n/a.
+ */
+static void page_backing_driver(copy_func_t copy_func)
+{
+    enum page_backing saved_backing = page_backing;
+    unsigned long chunk_size;
+    int nr_sizes = 0;
+    int b, c;
+    std::vector<long> result;
+
+    for (chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2)
+        nr_sizes++;
+    result.assign(nr_sizes * PAGE_BACKING_MAX, -1);
+
+    for (b = 0; b < PAGE_BACKING_MAX; b++)
+    {
+        cleanup_arrays();
+        page_backing = (enum page_backing)b;
+        for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
+        {
+            if (random_copy(copy_func, chunk_size) != 0)
+                break;
+            result[c * PAGE_BACKING_MAX + b] = last_bandwidth_mbps;
+        }
+    }
+
+    cleanup_arrays();
+    page_backing = saved_backing;
+
+    printf("MB/s");
+    for (b = 0; b < PAGE_BACKING_MAX; b++)
+        printf("\t\t%s", page_backing_names[b]);
+    printf("\n");
+    for (c = 0, chunk_size = block_size_min; chunk_size <= block_size_max; chunk_size *= 2, c++)
+    {
+        printf("%lu KB", chunk_size / KB);
+        for (b = 0; b < PAGE_BACKING_MAX; b++)
+        {
+            if (result[c * PAGE_BACKING_MAX + b] < 0)
+                printf("\t\tn/a");
+            else
+                printf("\t\t%ld", result[c * PAGE_BACKING_MAX + b]);
+        }
+        printf("\n");
+    }
+}
+
+static void run_variant(const char *name, copy_func_t copy_func, int flags = 0)
+{
+    if (!variant_selected(name))
+        return;
+    if (mode == MODE_ALIGN && (flags & VARIANT_ALIGNED))
+    {
+        printf("Skipping %s: requires aligned buffers\n", name);
+        return;
+    }
+    // plain copies are not expected to survive overlap, skip them silently
+    if (mode == MODE_OVERLAP && !(flags & VARIANT_OVERLAP))
+        return;
+    if (mode == MODE_WQS && !(flags & VARIANT_STRIPED))
+        return;
+    if (mode == MODE_FILL)
+        return;
+    // only the chunk order passes of random_copy() drain the queue before timing
+    if ((flags & VARIANT_ASYNC) && mode != MODE_SINGLE && mode != MODE_NUMA && mode != MODE_PAGES &&
+        mode != MODE_PATTERNS && mode != MODE_WQS)
+    {
+        printf("Skipping %s: asynchronous, not supported in this mode\n", name);
+        return;
+    }
+
+    printf("Copying using function: %s\n", name);
+    switch (mode)
+    {
+    case MODE_THREADS:
+        thread_scaling_driver(copy_func);
+        break;
+    case MODE_NUMA:
+        numa_matrix_driver(copy_func);
+        break;
+    case MODE_PAGES:
+        page_backing_driver(copy_func);
+        break;
+    case MODE_LATENCY:
+        latency_driver(copy_func);
+        break;
+    case MODE_PATTERNS:
+        pattern_driver(copy_func);
+        break;
+    case MODE_ALIGN:
+        align_driver(copy_func);
+        break;
+    case MODE_OVERLAP:
+        overlap_driver(copy_func);
+        break;
+    case MODE_WQS:
+        wq_scaling_driver(copy_func);
+        break;
+    default:
+        copy_driver(copy_func);
+        break;
+    }
+}
+
+static uint64_t xxh64_ref(const void *buf, size_t n)
+{
+    return xxh64(buf, n);
+}
+
+/**
+ * Check the checksum kernels before timing them, a fast wrong checksum is
+ * worse than a slow one.
+ */
+static void checksum_selftest(void)
+{
+    if (cpu_features.avx2)
+    {
+        if (!checksum_check(copy_crc32c, crc32c_ref64))
+            printf("Checksum self-test failed: copy_crc32c\n");
+        if (!checksum_check(copy_then_crc32c, crc32c_ref64))
+            printf("Checksum self-test failed: copy_then_crc32c\n");
+        if (!checksum_check(copy_xxh64, xxh64_ref))
+            printf("Checksum self-test failed: copy_xxh64\n");
+    }
+    if (dsa_wq && !checksum_check(copy_crc32c_dsa, crc32c_ref64))
+        printf("Checksum self-test failed: copy_crc32c_dsa\n");
+}
+
+/**
+ * Check the memmove kernels against memmove before timing them; the overlap
+ * sweep only verifies the distances it runs.
+ */
+static void memmove_selftest(void)
+{
+    if (!memmove_check(_rep_movsb_move))
+        printf("Memmove self-test failed: _rep_movsb_move\n");
+    if (cpu_features.avx2)
+    {
+        if (!memmove_check(_avx_memmove))
+            printf("Memmove self-test failed: _avx_memmove\n");
+        if (!memmove_check(_avx_memmove_nt))
+            printf("Memmove self-test failed: _avx_memmove_nt\n");
+    }
+    if (cpu_features.avx512bw)
+    {
+        if (!memmove_check(_avx512_memmove))
+            printf("Memmove self-test failed: _avx512_memmove\n");
+        if (!memmove_check(_avx512_memmove_nt))
+            printf("Memmove self-test failed: _avx512_memmove_nt\n");
+    }
+}
+
+static void run_fill_variant(const char *name, fill_func_t fill_func)
+{
+    if (mode != MODE_FILL || !variant_selected(name))
+        return;
+
+    printf("Filling using function: %s\n", name);
+    fill_driver(fill_func);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -g <GB>       buffer size in GB (default %lu)\n"
+           "  -b <KB>       smallest chunk size in KB\n"
+           "  -B <KB>       largest chunk size in KB\n"
+           "  -v <list>     only run variants whose name appears in the comma separated list\n"
+           "  -m <mode>     single | threads | numa | pages | calibrate | latency | patterns | align | fixed | overlap | fill | wqs |\n"
+           "                async | wait | consume\n"
+           "  -t <N>        cap worker threads in threads mode\n"
+           "  -S <node>     NUMA node of the source buffer\n"
+           "  -D <node>     NUMA node of the destination buffer\n"
+           "  -c <node>     NUMA node the copying thread runs on\n"
+           "  -p <backing>  page backing of the buffers: 4k | thp | 2m | 1g\n"
+           "  -P <file>     load dispatch tuning profile (default $COPY_TUNE_PROFILE)\n"
+           "  -o <file>     where calibrate mode writes the profile (default %s)\n"
+           "  -e            collect perf_event counters per variant and chunk size (single mode)\n"
+           "  -s <N>        sampled verification: check a random 1 in N of the 64 KB blocks\n"
+           "  -T <N>        verification threads (default: every allowed cpu)\n"
+           "  -a <pattern>  chunk access pattern: random | seq | reverse | strided | zipf | mixed\n"
+           "  -z <skew>     Zipf exponent for zipf/mixed (default %.2f)\n"
+           "  -H <pct>      share of hot-set draws in mixed (default %u)\n"
+           "  -x <chunks>   stride of the strided pattern (default %lu)\n"
+           "  -A <bytes>    offset step of the alignment sweep over 0..63 (default %lu)\n"
+           "  -L <fraction> rte_memcpy streams copies above this fraction of the per-cpu LLC share (default %.2f)\n"
+           "  -F <fill>     fill used to reset the buffers: dsa | avx512_nt | avx2_nt | rep_stosb | memset\n"
+           "  -k <wait>     how DSA completions are waited for: spin | umwait | tpause | yield (default spin)\n"
+           "  -I <N>        threads that first touch the buffers (default: every allowed cpu)\n"
+           "  -M            pre-fault the buffers when they are allocated\n"
+           "  -R <reset>    destination reset between passes: fill (rewrite it) | gen (tag chunk edges in the source) |\n"
+           "                drop (unmap its pages, copies go to cold memory)\n"
+           "  -w <wqs>      comma separated DSA WQs (wq0.0 or /dev/dsa/wq0.0), soft[:N] for N in-process\n"
+           "                stand-ins (default: every enabled user WQ in sysfs)\n"
+           "  -q <N>        descriptors in flight in copy_dsa_queued (default %lu)\n"
+           "  -Q <N>        descriptors per batch in copy_dsa_queued (default %lu, at most the\n"
+           "                WQs' max_batch_size)\n"
+           "  -W <model>    soft WQ model: engines=N,wq_size=N,latency=<ns>,bw=<MB/s per engine>,faults=0|1\n"
+           "  -y            pre-fault DSA destinations before submitting\n"
+           "  -C            DSA writes allocate in the LLC (IDXD_OP_FLAG_CC) instead of going to memory\n",
+           prog, n_gb, profile_out, zipf_skew, mixed_hot_pct, pattern_stride, align_step, llc_fraction,
+           dsa_queue_depth, dsa_queue_batch);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:b:B:v:m:t:S:D:c:p:P:o:es:T:a:z:H:x:A:L:F:k:I:MR:w:q:Q:W:yCh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            n_gb = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            block_size_min = strtoul(optarg, NULL, 0) * KB;
+            break;
+        case 'B':
+            block_size_max = strtoul(optarg, NULL, 0) * KB;
+            break;
+        case 'v':
+            variant_filter = optarg;
+            break;
+        case 'm':
+            if (!strcmp(optarg, "single"))
+                mode = MODE_SINGLE;
+            else if (!strcmp(optarg, "threads"))
+                mode = MODE_THREADS;
+            else if (!strcmp(optarg, "numa"))
+                mode = MODE_NUMA;
+            else if (!strcmp(optarg, "pages"))
+                mode = MODE_PAGES;
+            else if (!strcmp(optarg, "calibrate"))
+                mode = MODE_CALIBRATE;
+            else if (!strcmp(optarg, "latency"))
+                mode = MODE_LATENCY;
+            else if (!strcmp(optarg, "patterns"))
+                mode = MODE_PATTERNS;
+            else if (!strcmp(optarg, "align"))
+                mode = MODE_ALIGN;
+            else if (!strcmp(optarg, "fixed"))
+                mode = MODE_FIXED;
+            else if (!strcmp(optarg, "overlap"))
+                mode = MODE_OVERLAP;
+            else if (!strcmp(optarg, "fill"))
+                mode = MODE_FILL;
+            else if (!strcmp(optarg, "wqs"))
+                mode = MODE_WQS;
+            else if (!strcmp(optarg, "async"))
+                mode = MODE_ASYNC;
+            else if (!strcmp(optarg, "wait"))
+                mode = MODE_WAIT;
+            else if (!strcmp(optarg, "consume"))
+                mode = MODE_CONSUME;
+            else
+            {
+                printf("Unknown mode %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'S':
+            src_node = atoi(optarg);
+            break;
+        case 'D':
+            dst_node = atoi(optarg);
+            break;
+        case 'c':
+            cpu_node = atoi(optarg);
+            break;
+        case 'p':
+            if (parse_page_backing(optarg) < 0)
+            {
+                printf("Unknown page backing %s\n", optarg);
+                return -1;
+            }
+            page_backing = (enum page_backing)parse_page_backing(optarg);
+            break;
+        case 'P':
+            profile_in = optarg;
+            break;
+        case 'o':
+            profile_out = optarg;
+            break;
+        case 'e':
+            use_perf = true;
+            break;
+        case 's':
+            verify_sample = std::max(1UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'T':
+            verify_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            if (parse_access_pattern(optarg) < 0)
+            {
+                printf("Unknown access pattern %s\n", optarg);
+                return -1;
+            }
+            access_pattern = (enum access_pattern)parse_access_pattern(optarg);
+            break;
+        case 'z':
+            zipf_skew = strtod(optarg, NULL);
+            break;
+        case 'H':
+            mixed_hot_pct = std::min(100UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'x':
+            pattern_stride = std::max(1UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'A':
+            align_step = std::max(1UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'L':
+            llc_fraction = strtod(optarg, NULL);
+            break;
+        case 'F':
+            fill_name = optarg;
+            break;
+        case 'k':
+            if (dsa_wait_parse(optarg) != 0)
+            {
+                printf("Unknown DSA wait strategy %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'I':
+            init_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'M':
+            prefault = true;
+            break;
+        case 'y':
+            dsa_prefault = true;
+            break;
+        case 'C':
+            dsa_op_flags |= IDXD_OP_FLAG_CC;
+            break;
+        case 'R':
+            if (!strcmp(optarg, "fill"))
+                reset_mode = RESET_FILL;
+            else if (!strcmp(optarg, "gen"))
+                reset_mode = RESET_GENERATION;
+            else if (!strcmp(optarg, "drop"))
+                reset_mode = RESET_DROP;
+            else
+            {
+                printf("Unknown reset mode %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'w':
+            dsa_wq_spec = optarg;
+            break;
+        case 'q':
+            dsa_queue_depth = std::max(1UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'Q':
+            dsa_queue_batch = std::max(1UL, strtoul(optarg, NULL, 0));
+            break;
+        case 'W':
+            if (dsa_soft_parse(optarg) != 0)
+            {
+                printf("Bad soft WQ model %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (n_gb == 0 || block_size_min <= 0 || block_size_max < block_size_min)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    if ((unsigned long)block_size_max > GB_TO_BYTES(n_gb))
+    {
+        printf("Largest chunk %d KB exceeds the %lu GB buffer\n", block_size_max / KB, n_gb);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (parse_args(argc, argv) != 0)
+        return 1;
+    if (mode == MODE_THREADS && cpu_topology_init() <= 0)
+        return 1;
+    bind_thread_to_node(cpu_node);
+    cpu_features_init();
+    cpu_features_print();
+    dsa_wait_init();
+    verify_init();
+    if (cpu_features.avx512)
+        rte_memcpy_init(llc_fraction);
+    if (mode == MODE_LATENCY || mode == MODE_WAIT || mode == MODE_CONSUME)
+        tsc_calibrate();
+    if (use_perf)
+        perf_counters_open();
+
+    // DSA is configured after the first allocation, until then fall back to the cpu
+    fill_init(false);
+    if (fill_select(fill_name) != 0)
+        fill_select(NULL);
+
+    if (allocate_and_initialize_arrays() != 0)
+        return 1;
+    configure_dsa();
+    // the soft WQ fills at memset speed at best, never pick it by default
+    fill_init(dsa_wq && !dsa_soft);
+    if (fill_select(fill_name) != 0)
+    {
+        printf("Buffer fill %s not available on this host\n", fill_name);
+        fill_select(NULL);
+    }
+    printf("Buffer fill: %s\n", buffer_fill.name);
+    checksum_selftest();
+    memmove_selftest();
+    // a profile from another machine may be rejected, calibration always starts from CPUID defaults
+    dispatch_init(mode == MODE_CALIBRATE ? NULL : profile_in ? profile_in : getenv("COPY_TUNE_PROFILE"));
+    hybrid_init();
+
+    if (mode == MODE_CALIBRATE)
+    {
+        calibrate_driver();
+        return 0;
+    }
+    if (mode == MODE_FIXED)
+    {
+        fixed_driver();
+        return 0;
+    }
+    if (mode == MODE_ASYNC)
+    {
+        async_driver();
+        return 0;
+    }
+    if (mode == MODE_WAIT)
+    {
+        wait_driver();
+        return 0;
+    }
+    if (mode == MODE_CONSUME)
+    {
+        consume_driver();
+        return 0;
+    }
+
     COPY_USING(_rep_movsb);
-    COPY_USING(copy_dsa);
-    COPY_USING(rte_memcpy);
+    COPY_USING_IF(copy_dsa, dsa_wq);
+    STRIPE_USING_IF(copy_dsa_striped, dsa_wq);
+    COPY_ASYNC_USING_IF(copy_dsa_queued, copy_dsa_queued_drain, dsa_wq, VARIANT_STRIPED);
+    COPY_USING_IF(copy_hybrid, dsa_wq);
+    hybrid_print();
+    COPY_USING_IF(rte_memcpy, cpu_features.avx512);
+    COPY_USING_IF(rte_memcpy_temporal, cpu_features.avx512);
+    COPY_USING_IF(rte_memcpy_nt, cpu_features.avx512);
     COPY_USING(memcpy);
-    COPY_USING(_avx_cpy);
-    COPY_USING(_avx_async_cpy);
-    COPY_USING(_avx_async_pf_cpy);
-    COPY_USING(_avx_cpy_unroll);
-    COPY_USING(_avx_async_cpy_unroll);
-    COPY_USING(_avx_async_pf_cpy_unroll);
+    MOVE_USING_IF(memmove, true);
+    MOVE_USING_IF(_rep_movsb_move, true);
+    MOVE_USING_IF(_avx_memmove, cpu_features.avx2);
+    MOVE_USING_IF(_avx_memmove_nt, cpu_features.avx2);
+    MOVE_USING_IF(_avx512_memmove, cpu_features.avx512bw);
+    MOVE_USING_IF(_avx512_memmove_nt, cpu_features.avx512bw);
+    COPY_USING_IF(copy_then_crc32c, cpu_features.avx2);
+    COPY_USING_IF(copy_crc32c, cpu_features.avx2);
+    COPY_USING_IF(copy_crc32c_dsa, dsa_wq);
+    COPY_USING(copy_then_xxh64);
+    COPY_USING_IF(copy_xxh64, cpu_features.avx2);
+    FILL_USING_IF(memset, true);
+    FILL_USING_IF(_rep_stosb, true);
+    FILL_USING_IF(fill_dsa, dsa_wq);
+    FILL_USING_IF(_avx_fill, cpu_features.avx2);
+    FILL_USING_IF(_avx_fill_nt, cpu_features.avx2);
+    FILL_USING_IF(_avx512_fill, cpu_features.avx512bw);
+    FILL_USING_IF(_avx512_fill_nt, cpu_features.avx512bw);
+    COPY_USING(dispatch_memcpy);
+    COPY_USING_ALIGNED_IF(_avx_cpy, cpu_features.avx2);
+    COPY_USING_ALIGNED_IF(_avx_async_cpy, cpu_features.avx2);
+    COPY_USING_ALIGNED_IF(_avx_async_pf_cpy, cpu_features.avx2);
+    COPY_USING_ALIGNED_IF(_avx_cpy_unroll, cpu_features.avx2);
+    COPY_USING_ALIGNED_IF(_avx_async_cpy_unroll, cpu_features.avx2);
+    COPY_USING_ALIGNED_IF(_avx_async_pf_cpy_unroll, cpu_features.avx2);
+    COPY_USING_IF(_avx_cpy_any, cpu_features.avx2);
+    COPY_USING_IF(_avx_async_cpy_any, cpu_features.avx2);
+    COPY_USING_IF(_avx_async_pf_cpy_any, cpu_features.avx2);
+    COPY_USING_IF(_avx_cpy_unroll_any, cpu_features.avx2);
+    COPY_USING_IF(_avx_async_cpy_unroll_any, cpu_features.avx2);
+    COPY_USING_IF(_avx_async_pf_cpy_unroll_any, cpu_features.avx2);
+    COPY_USING_IF(_avx512_cpy, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_nt_store_cpy, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_nt_load_cpy, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_cpy, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_pf_cpy, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_cpy_unroll2, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_cpy_unroll, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_cpy_unroll8, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_cpy_unroll2, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_cpy_unroll, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_cpy_unroll8, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_pf_cpy_unroll, cpu_features.avx512bw);
+    COPY_USING_IF(_avx512_async_pf_cpy_unroll8, cpu_features.avx512bw);
 
+    perf_counters_close();
+    dsa_soft_print_stats();
+    dsa_queue_free(&dsa_queue);
+    dsa_cleanup();
     printf("Memory copy suit finished\n");
     return 0;
 }
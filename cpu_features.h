@@ -0,0 +1,92 @@
+#include <cpuid.h>
+
+/**
+ * Per-function ISA enablement. The binary is built for baseline x86-64 and
+ * every kernel that uses wider vectors carries its own target so it can be
+ * compiled in, but must only be called after checking cpu_features.
+ */
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl")))
+#define TARGET_MOVDIR64B __attribute__((target("movdir64b")))
+#define TARGET_WAITPKG __attribute__((target("waitpkg")))
+
+struct cpu_features
+{
+    bool erms;      // enhanced rep movsb/stosb
+    bool fsrm;      // fast short rep movsb
+    bool avx2;
+    bool avx512f;
+    bool avx512bw;
+    bool avx512vl;
+    bool avx512;    // f, bw and vl together, what TARGET_AVX512 code needs
+    bool movdir64b; // dedicated work queue submission
+    bool enqcmd;    // shared work queue submission
+    bool waitpkg;   // UMONITOR/UMWAIT/TPAUSE
+};
+
+static struct cpu_features cpu_features;
+
+static inline uint64_t xgetbv0(void)
+{
+    uint32_t eax, edx;
+
+    asm volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+/**
+ * Probe CPUID once. Vector features are only reported when the OS also
+ * saves the corresponding register state (XCR0), otherwise using them
+ * faults even though CPUID advertises them.
+ */
+static void cpu_features_init(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    bool os_avx = false, os_avx512 = false;
+
+    memset(&cpu_features, 0, sizeof(cpu_features));
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return;
+    if (ecx & bit_OSXSAVE)
+    {
+        uint64_t xcr0 = xgetbv0();
+        os_avx = (xcr0 & 0x6) == 0x6;      // SSE + AVX state
+        os_avx512 = (xcr0 & 0xe6) == 0xe6; // + opmask, ZMM_Hi256, Hi16_ZMM
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return;
+
+    cpu_features.erms = ebx & (1 << 9);
+    cpu_features.fsrm = edx & (1 << 4);
+    cpu_features.avx2 = os_avx && (ebx & bit_AVX2);
+    cpu_features.avx512f = os_avx512 && (ebx & bit_AVX512F);
+    cpu_features.avx512bw = os_avx512 && (ebx & bit_AVX512BW);
+    cpu_features.avx512vl = os_avx512 && (ebx & bit_AVX512VL);
+    cpu_features.avx512 = cpu_features.avx512f && cpu_features.avx512bw && cpu_features.avx512vl;
+    cpu_features.movdir64b = ecx & bit_MOVDIR64B;
+    cpu_features.enqcmd = ecx & bit_ENQCMD;
+    cpu_features.waitpkg = ecx & bit_WAITPKG;
+}
+
+static void cpu_features_print(void)
+{
+    printf("CPU features: erms %d fsrm %d avx2 %d avx512f %d avx512bw %d avx512vl %d movdir64b %d enqcmd %d waitpkg %d\n",
+           cpu_features.erms, cpu_features.fsrm, cpu_features.avx2,
+           cpu_features.avx512f, cpu_features.avx512bw, cpu_features.avx512vl,
+           cpu_features.movdir64b, cpu_features.enqcmd, cpu_features.waitpkg);
+}
+
+/**
+ * Copy the 48 character processor brand string into buf (49 bytes).
+ */
+static void cpu_brand_string(char *buf)
+{
+    unsigned int regs[12] = {0};
+
+    for (unsigned int i = 0; i < 3; i++)
+        __get_cpuid(0x80000002 + i, &regs[i * 4 + 0], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+    memcpy(buf, regs, 48);
+    buf[48] = '\0';
+}
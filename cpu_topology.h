@@ -0,0 +1,173 @@
+#include <sched.h>
+#include <pthread.h>
+#include <algorithm>
+
+#define MAX_CPUS 1024
+
+struct cpu_info
+{
+    int cpu;
+    int package; // physical socket
+    int core;    // core id within the socket
+    int smt;     // index of this hw thread among siblings of the same core
+};
+
+static struct cpu_info cpu_topology[MAX_CPUS];
+static int cpu_topology_count;
+
+static int read_sysfs_int(const char *path, int def)
+{
+    FILE *f = fopen(path, "r");
+    int val;
+
+    if (!f)
+        return def;
+    if (fscanf(f, "%d", &val) != 1)
+        val = def;
+    fclose(f);
+    return val;
+}
+
+/**
+ * Discover the cpus this process may run on together with their
+ * socket/core/smt position. Falls back to a flat topology when sysfs
+ * is not readable.
+ */
+static int cpu_topology_init(void)
+{
+    cpu_set_t set;
+    char path[128];
+    int i, j;
+
+    cpu_topology_count = 0;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        printf("sched_getaffinity failed with errno = %d.\n", errno);
+        return -1;
+    }
+
+    for (i = 0; i < CPU_SETSIZE && cpu_topology_count < MAX_CPUS; i++)
+    {
+        struct cpu_info *info;
+
+        if (!CPU_ISSET(i, &set))
+            continue;
+
+        info = &cpu_topology[cpu_topology_count++];
+        info->cpu = i;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        info->package = read_sysfs_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        info->core = read_sysfs_int(path, i);
+        info->smt = 0;
+    }
+
+    // cpus are enumerated in ascending order, so earlier siblings get lower smt index
+    for (i = 0; i < cpu_topology_count; i++)
+    {
+        for (j = 0; j < i; j++)
+        {
+            if (cpu_topology[j].package == cpu_topology[i].package &&
+                cpu_topology[j].core == cpu_topology[i].core)
+                cpu_topology[i].smt++;
+        }
+    }
+
+    return cpu_topology_count;
+}
+
+/**
+ * Build an ordered list of cpus to place worker threads on.
+ *
+ * @param smt
+ *   When false only the first hw thread of every core is used, when true
+ *   siblings are placed next to each other so low thread counts share cores.
+ * @param spread
+ *   When false sockets are filled one after another, when true consecutive
+ *   threads are distributed round-robin across sockets.
+ * @return
+ *   Number of cpus written to out.
+ */
+static int cpu_placement(bool smt, bool spread, int *out, int max)
+{
+    std::vector<struct cpu_info> cpus;
+    std::vector<int> next;
+    int n = 0;
+    int packages = 0;
+
+    for (int i = 0; i < cpu_topology_count; i++)
+    {
+        if (!smt && cpu_topology[i].smt != 0)
+            continue;
+        cpus.push_back(cpu_topology[i]);
+        packages = std::max(packages, cpu_topology[i].package + 1);
+    }
+
+    std::sort(cpus.begin(), cpus.end(),
+              [](const struct cpu_info &a, const struct cpu_info &b)
+              {
+                  if (a.package != b.package)
+                      return a.package < b.package;
+                  if (a.core != b.core)
+                      return a.core < b.core;
+                  return a.smt < b.smt;
+              });
+
+    if (!spread)
+    {
+        for (size_t i = 0; i < cpus.size() && n < max; i++)
+            out[n++] = cpus[i].cpu;
+        return n;
+    }
+
+    // round-robin over sockets, keeping smt siblings of a core together
+    next.assign(packages, 0);
+    while (n < max && n < (int)cpus.size())
+    {
+        for (int p = 0; p < packages && n < max; p++)
+        {
+            size_t idx = 0;
+            int seen = 0;
+
+            for (idx = 0; idx < cpus.size(); idx++)
+            {
+                if (cpus[idx].package != p)
+                    continue;
+                if (seen++ == next[p])
+                    break;
+            }
+            if (idx == cpus.size())
+                continue;
+            out[n++] = cpus[idx].cpu;
+            next[p]++;
+        }
+    }
+    return n;
+}
+
+static int cpu_package(int cpu)
+{
+    for (int i = 0; i < cpu_topology_count; i++)
+    {
+        if (cpu_topology[i].cpu == cpu)
+            return cpu_topology[i].package;
+    }
+    return 0;
+}
+
+static int pin_thread_to_cpu(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    int ret;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (ret != 0)
+    {
+        printf("pthread_setaffinity_np cpu %d failed with errno = %d.\n", cpu, ret);
+        return -1;
+    }
+    return 0;
+}
@@ -4,14 +4,72 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 
-static void *dsa_wq = MAP_FAILED;
-static int dedicated_mode = 0;
+#define DSA_WQ_SIZE 4096
+#define DSA_MAX_XFER (2UL << 20) // default max_transfer_size of a wq
+#define DSA_MAX_WQS 64
+#define DSA_WAIT_C01 1             // UMWAIT/TPAUSE state C0.1: shallower than C0.2, wakes faster
+#define DSA_UMWAIT_TSC 100000      // UMWAIT deadline, the store to the record ends it early
+#define DSA_TPAUSE_TSC 1000        // TPAUSE nap between looks at the record
+#define DSA_YIELD_SPINS 64         // yields before the yield strategy starts sleeping
+#define DSA_SLEEP_NS 1000          // first sleep, doubled up to DSA_SLEEP_MAX_NS
+#define DSA_SLEEP_MAX_NS 64000
+
+struct dsa_soft_queue;
+
+/**
+ * A work queue the process can submit to, either a mapped portal or an
+ * instance of the in-process stand-in of dsa_soft.h.
+ */
+struct dsa_wq_info
+{
+    char name[32];          // wqX.Y as in sysfs, softN for the stand-in
+    void *portal;
+    bool dedicated;         // MOVDIR64B, otherwise ENQCMD
+    int node;               // NUMA node of the device, NUMA_NODE_ANY when unknown
+    unsigned long size;     // entries
+    unsigned long max_batch;
+    unsigned long max_xfer;
+    bool cache_control;     // honours IDXD_OP_FLAG_CC
+    struct dsa_soft_queue *soft;
+};
+
+static struct dsa_wq_info dsa_wqs[DSA_MAX_WQS];
+static int dsa_nr_wqs;
+static struct dsa_wq_info *dsa_wq = NULL; // the preferred WQ, used by the single queue paths
 static int max_retry_count = 1000000;
 static int resubmit_copy_retry = 8;
 static int top_retry_count;
+static bool dsa_soft = false; // some WQ is the in-process stand-in
+// of every descriptor; -C adds IDXD_OP_FLAG_CC, which writes the destination to the LLC instead of memory
+static uint32_t dsa_op_flags = IDXD_OP_FLAG_RCR | IDXD_OP_FLAG_CRAV;
 
-#define DSA_WQ_SIZE 4096
+/**
+ * How poll_completion() passes the time until the completion record is
+ * written. spin keeps the core busy with pause, umwait sleeps in C0.1 until
+ * the record's cache line is written, tpause naps in C0.1 for a fixed
+ * number of TSC cycles between looks, and yield gives the cpu to other
+ * threads, then sleeps with exponential backoff. umwait and tpause need
+ * WAITPKG, see dsa_wait_init().
+ */
+enum dsa_wait_mode
+{
+    DSA_WAIT_SPIN,
+    DSA_WAIT_UMWAIT,
+    DSA_WAIT_TPAUSE,
+    DSA_WAIT_YIELD,
+    DSA_WAIT_MODES,
+};
+
+static const char *dsa_wait_names[] = {"spin", "umwait", "tpause", "yield"};
+static enum dsa_wait_mode dsa_wait_mode = DSA_WAIT_SPIN;
+static thread_local uint64_t dsa_wait_cycles; // TSC cycles the thread spent in poll_completion()
+static bool dsa_prefault = false;             // populate destination pages before submitting
+static unsigned long dsa_faults;              // partial completions resumed after a page fault
+static unsigned long dsa_resubmits;           // descriptors submitted again, resumed or as they were
+
+static int dsa_soft_submit(struct dsa_soft_queue *q, const struct dsa_hw_desc *descriptor);
 
 static inline unsigned int
 enqcmd(void *dst, const void *src)
@@ -46,21 +104,35 @@ static void *map_dsa_device(const char *dsa_wq_path)
     return dsa_device;
 }
 
-static int submit_wi(void *wq, void *descriptor)
+TARGET_MOVDIR64B static int submit_wi(const struct dsa_wq_info *wq, void *descriptor)
 {
     int retry = 0;
 
     _mm_sfence();
 
-    if (dedicated_mode)
+    if (wq->soft)
+    {
+        // refused like ENQCMD to a full shared WQ, let the engines drain it
+        while (dsa_soft_submit(wq->soft, (const struct dsa_hw_desc *)descriptor) != 0)
+        {
+            if (++retry > max_retry_count)
+            {
+                printf("Submit work retry %d times.\n", retry);
+                exit(1);
+            }
+            sched_yield();
+        }
+        return 0;
+    }
+    if (wq->dedicated)
     {
-        _movdir64b(dsa_wq, descriptor);
+        _movdir64b(wq->portal, descriptor);
     }
     else
     {
         while (1)
         {
-            if (enqcmd(dsa_wq, descriptor) == 0)
+            if (enqcmd(wq->portal, descriptor) == 0)
             {
                 break;
             }
@@ -76,21 +148,91 @@ static int submit_wi(void *wq, void *descriptor)
     return 0;
 }
 
+static int dsa_wait_parse(const char *name)
+{
+    for (int i = 0; i < DSA_WAIT_MODES; i++)
+    {
+        if (!strcmp(name, dsa_wait_names[i]))
+        {
+            dsa_wait_mode = (enum dsa_wait_mode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Fall back to spinning when the cpu cannot UMWAIT/TPAUSE. Call after
+ * cpu_features_init().
+ */
+static void dsa_wait_init(void)
+{
+    if ((dsa_wait_mode == DSA_WAIT_UMWAIT || dsa_wait_mode == DSA_WAIT_TPAUSE) && !cpu_features.waitpkg)
+    {
+        printf("cpu lacks WAITPKG, waiting for DSA with spin instead of %s\n", dsa_wait_names[dsa_wait_mode]);
+        dsa_wait_mode = DSA_WAIT_SPIN;
+    }
+}
+
+/**
+ * One wait step of poll_completion() after the retry-th look at the record.
+ */
+TARGET_WAITPKG static inline void dsa_wait_step(struct dsa_completion_record *completion, int retry)
+{
+    struct timespec nap;
+
+    switch (dsa_wait_mode)
+    {
+    case DSA_WAIT_UMWAIT:
+        _umonitor(completion);
+        // the record may have been written before the monitor was armed
+        if (__atomic_load_n(&completion->status, __ATOMIC_ACQUIRE) == DSA_COMP_NONE)
+            _umwait(DSA_WAIT_C01, __rdtsc() + DSA_UMWAIT_TSC);
+        break;
+    case DSA_WAIT_TPAUSE:
+        _tpause(DSA_WAIT_C01, __rdtsc() + DSA_TPAUSE_TSC);
+        break;
+    case DSA_WAIT_YIELD:
+        if (retry < DSA_YIELD_SPINS)
+        {
+            sched_yield();
+            break;
+        }
+        nap.tv_sec = 0;
+        nap.tv_nsec = std::min((long)DSA_SLEEP_NS << std::min(retry - DSA_YIELD_SPINS, 6), (long)DSA_SLEEP_MAX_NS);
+        nanosleep(&nap, NULL);
+        break;
+    default:
+        // soft WQ engines may need this cpu to make progress
+        if (dsa_soft)
+            sched_yield();
+        else
+            _mm_pause();
+        break;
+    }
+}
+
 static int poll_completion(struct dsa_completion_record *completion,
                            enum dsa_opcode opcode)
 {
+    uint64_t start = __rdtsc();
     int retry = 0;
 
     while (1)
     {
-        if (completion->status != DSA_COMP_NONE)
+        if (__atomic_load_n(&completion->status, __ATOMIC_ACQUIRE) != DSA_COMP_NONE)
         {
-            /* TODO: Error handling here. */
-            if (completion->status != DSA_COMP_SUCCESS &&
-                completion->status != DSA_COMP_PAGE_FAULT_NOBOF)
+            uint8_t status = completion->status & DSA_COMP_STATUS_MASK;
+
+            // page faults are not errors, dsa_resubmit() resumes them; a
+            // failed batch's members report in their own records
+            if (status != DSA_COMP_SUCCESS &&
+                status != DSA_COMP_PAGE_FAULT_NOBOF &&
+                status != DSA_COMP_BATCH_FAIL)
             {
                 printf("DSA opcode %d failed with status = %d.\n",
                        opcode, completion->status);
+                dsa_wait_cycles += __rdtsc() - start;
                 return 1;
             }
             break;
@@ -99,10 +241,12 @@ static int poll_completion(struct dsa_completion_record *completion,
         if (retry > max_retry_count)
         {
             printf("Wait for completion retry %d times.\n", retry);
+            dsa_wait_cycles += __rdtsc() - start;
             return 1;
         }
-        _mm_pause();
+        dsa_wait_step(completion, retry);
     }
+    dsa_wait_cycles += __rdtsc() - start;
 
     if (retry > top_retry_count)
     {
@@ -112,6 +256,143 @@ static int poll_completion(struct dsa_completion_record *completion,
     return 0;
 }
 
+/**
+ * Make the pages of a destination present before the device writes them,
+ * so a copy into cold memory does not stop at every page. Kernels without
+ * MADV_POPULATE_WRITE get a write per page instead.
+ */
+static void dsa_prefault_range(void *dst, size_t len)
+{
+    uintptr_t start = (uintptr_t)dst & ~4095UL;
+    uintptr_t end = ((uintptr_t)dst + len + 4095) & ~4095UL;
+
+    if (!dsa_prefault || len == 0)
+        return;
+    if (madvise((void *)start, end - start, MADV_POPULATE_WRITE) == 0)
+        return;
+    for (uintptr_t page = start; page < end; page += 4096)
+        __atomic_fetch_add((uint8_t *)std::max(page, (uintptr_t)dst), 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Fault in the page an operation stopped at from the cpu: written for a
+ * destination, read for a source. Adding 0 atomically writes the page
+ * without racing the device on the bytes it already moved. A cold page
+ * rarely comes alone, the rest of the buffer the operation has yet to
+ * cover is populated after it so the resumed part runs through.
+ */
+static void dsa_touch_fault(const struct dsa_hw_desc *desc, const struct dsa_completion_record *comp)
+{
+    bool write = comp->status & DSA_COMP_STATUS_WRITE;
+    uintptr_t end = (write ? desc->dst_addr : desc->src_addr) + desc->xfer_size;
+    uintptr_t next = (comp->fault_addr & ~4095UL) + 4096;
+
+    if (write)
+        __atomic_fetch_add((uint8_t *)comp->fault_addr, 0, __ATOMIC_RELAXED);
+    else
+        (void)*(volatile const uint8_t *)comp->fault_addr;
+    if (next < end)
+        madvise((void *)next, ((end + 4095) & ~4095UL) - next, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ);
+}
+
+/**
+ * Move desc past the bytes_completed of a partial completion, so that
+ * submitting it again does only what is left. CRC operations carry the
+ * partial CRC over as the seed.
+ */
+static void dsa_advance(struct dsa_hw_desc *desc, const struct dsa_completion_record *comp)
+{
+    uint32_t done = comp->bytes_completed;
+
+    switch (desc->opcode)
+    {
+    case DSA_OPCODE_MEMMOVE:
+        // result bit 0: an overlapping move ran from the end, the front is left
+        if (!(comp->result & 1))
+        {
+            desc->src_addr += done;
+            desc->dst_addr += done;
+        }
+        break;
+    case DSA_OPCODE_MEMFILL:
+        desc->dst_addr += done;
+        break;
+    case DSA_OPCODE_COPY_CRC:
+        desc->src_addr += done;
+        desc->dst_addr += done;
+        desc->crc_seed = comp->crc_val;
+        break;
+    case DSA_OPCODE_CRCGEN:
+        desc->src_addr += done;
+        desc->crc_seed = comp->crc_val;
+        break;
+    default:
+        return;
+    }
+    desc->xfer_size -= done;
+}
+
+/**
+ * Finish a descriptor whose completion record reports anything but
+ * success. Without block on fault a page fault stops the operation and
+ * the record says how far it got and where: the page is touched, and only
+ * the rest is submitted again. Other failures submit the descriptor again
+ * as it is. Gives up after resubmit_copy_retry attempts in a row without
+ * progress. A record that is still unwritten, such as after a wait that
+ * timed out, is waited for instead: the descriptor may still be in flight,
+ * and is never submitted twice.
+ */
+static void dsa_resubmit(const struct dsa_wq_info *wq, struct dsa_hw_desc *desc,
+                         struct dsa_completion_record *comp)
+{
+    int stalled = 0;
+
+    while (comp->status != DSA_COMP_SUCCESS)
+    {
+        bool progress = false;
+
+        if (__atomic_load_n(&comp->status, __ATOMIC_ACQUIRE) == DSA_COMP_NONE)
+        {
+            if (poll_completion(comp, (enum dsa_opcode)desc->opcode) != 0 &&
+                comp->status == DSA_COMP_NONE)
+            {
+                printf("DSA opcode %d never completed\n", desc->opcode);
+                exit(1);
+            }
+            continue;
+        }
+        if ((comp->status & DSA_COMP_STATUS_MASK) == DSA_COMP_PAGE_FAULT_NOBOF &&
+            comp->bytes_completed < desc->xfer_size)
+        {
+            progress = comp->bytes_completed != 0;
+            __atomic_fetch_add(&dsa_faults, 1, __ATOMIC_RELAXED);
+            dsa_touch_fault(desc, comp);
+            dsa_advance(desc, comp);
+        }
+        stalled = progress ? 0 : stalled + 1;
+        if (stalled > resubmit_copy_retry)
+        {
+            printf("DSA opcode %d FAILED with status = %d...\n", desc->opcode, comp->status);
+            exit(1);
+        }
+        __atomic_fetch_add(&dsa_resubmits, 1, __ATOMIC_RELAXED);
+        memset(comp, 0, sizeof(*comp));
+        submit_wi(wq, desc);
+    }
+}
+
+static void dsa_fault_stats_reset(void)
+{
+    dsa_faults = 0;
+    dsa_resubmits = 0;
+}
+
+static void dsa_fault_stats_print(void)
+{
+    if (dsa_faults || dsa_resubmits)
+        printf("\tDSA: %lu page faults resumed, %lu resubmissions\n", dsa_faults, dsa_resubmits);
+}
+
 static void* copy_dsa(void *dst, const void *src, size_t len)
 {
     struct dsa_completion_record completion __attribute__((aligned(32)));
@@ -122,36 +403,89 @@ static void* copy_dsa(void *dst, const void *src, size_t len)
     memset(&descriptor, 0, sizeof(descriptor));
 
     descriptor.opcode = DSA_OPCODE_MEMMOVE;
-    descriptor.flags = IDXD_OP_FLAG_RCR | IDXD_OP_FLAG_CRAV;
+    descriptor.flags = dsa_op_flags;
     descriptor.xfer_size = len;
     descriptor.src_addr = (uintptr_t)src;
     descriptor.dst_addr = (uintptr_t)dst;
     completion.status = 0;
     descriptor.completion_addr = (uint64_t)&completion;
 
+    dsa_prefault_range(dst, len);
     // printf("Submitting work to DSA work queue.....\n");
+    submit_wi(dsa_wq, &descriptor);
+    // printf("Polling for completion.....\n");
+    poll_completion(&completion, DSA_OPCODE_MEMMOVE);
+    if (completion.status != DSA_COMP_SUCCESS)
+        dsa_resubmit(dsa_wq, &descriptor, &completion);
+    return dst;
+}
+
+/**
+ * Fill len bytes at dst with c using DSA_OPCODE_MEMFILL. Larger fills are
+ * issued as consecutive descriptors of at most the WQ's max_xfer bytes.
+ */
+static void *fill_dsa(void *dst, int c, size_t len)
+{
+    struct dsa_completion_record completion __attribute__((aligned(32)));
+    struct dsa_hw_desc descriptor;
+    size_t done, xfer;
 
-    for (int i = 0; i < resubmit_copy_retry; i++)
+    dsa_prefault_range(dst, len);
+    memset(&descriptor, 0, sizeof(descriptor));
+    descriptor.opcode = DSA_OPCODE_MEMFILL;
+    descriptor.flags = dsa_op_flags;
+    descriptor.pattern = 0x0101010101010101ULL * (uint8_t)c;
+    descriptor.completion_addr = (uint64_t)&completion;
+
+    for (done = 0; done < len; done += xfer)
     {
+        xfer = std::min(len - done, dsa_wq->max_xfer);
+        descriptor.dst_addr = (uintptr_t)dst + done;
+        descriptor.xfer_size = xfer;
+        memset(&completion, 0, sizeof(completion));
         submit_wi(dsa_wq, &descriptor);
-        // printf("Polling for completion.....\n");
-        poll_completion(&completion, DSA_OPCODE_COMPARE);
-
-        if (completion.status == DSA_COMP_SUCCESS)
-        {
-            // printf("DSA operation completed!\n");
-            return dst;
-        }
+        poll_completion(&completion, DSA_OPCODE_MEMFILL);
+        if (completion.status != DSA_COMP_SUCCESS)
+            dsa_resubmit(dsa_wq, &descriptor, &completion);
     }
+    return dst;
+}
+
+/**
+ * Copy len bytes and return the CRC32C of the data, DSA_OPCODE_COPY_CRC.
+ * Seeded with ~0 and inverted on completion to follow the iSCSI convention
+ * of the software kernels; checksum_check() reports any disagreement.
+ */
+static uint32_t copy_crc_dsa(void *dst, const void *src, size_t len)
+{
+    struct dsa_completion_record completion __attribute__((aligned(32)));
+    struct dsa_hw_desc descriptor;
+
+    memset(&descriptor, 0, sizeof(descriptor));
+    descriptor.opcode = DSA_OPCODE_COPY_CRC;
+    descriptor.flags = dsa_op_flags;
+    descriptor.xfer_size = len;
+    descriptor.src_addr = (uintptr_t)src;
+    descriptor.dst_addr = (uintptr_t)dst;
+    descriptor.crc_seed = ~0U;
+    descriptor.completion_addr = (uint64_t)&completion;
 
-    printf("DSA COPY FAILED...\n");
-    exit(1);
+    dsa_prefault_range(dst, len);
+    memset(&completion, 0, sizeof(completion));
+    submit_wi(dsa_wq, &descriptor);
+    poll_completion(&completion, DSA_OPCODE_COPY_CRC);
+    if (completion.status != DSA_COMP_SUCCESS)
+        dsa_resubmit(dsa_wq, &descriptor, &completion);
+    return ~(uint32_t)completion.crc_val;
 }
 
 void dsa_cleanup(void)
 {
-    if (dsa_wq != MAP_FAILED)
+    for (int i = 0; i < dsa_nr_wqs; i++)
     {
-        munmap(dsa_wq, DSA_WQ_SIZE);
+        if (dsa_wqs[i].portal != MAP_FAILED)
+            munmap(dsa_wqs[i].portal, DSA_WQ_SIZE);
     }
+    dsa_nr_wqs = 0;
+    dsa_wq = NULL;
 }
\ No newline at end of file
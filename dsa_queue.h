@@ -0,0 +1,265 @@
+/**
+ * Queued DSA copies.
+ *
+ * copy_dsa() has one descriptor in flight and waits for it, so small
+ * chunks only measure the round trip to the device. A dsa_queue instead
+ * owns a ring of descriptors and completion records, allocated once and
+ * aligned the way the device wants them: 64 bytes for descriptors, so any
+ * run of ring slots is a valid batch list, and 32 for completion records.
+ * Copies are appended to the ring and leave as one DSA_OPCODE_BATCH
+ * descriptor per batch_size of them. The caller only waits when the ring is
+ * full, and then reaps every finished slot in ring order at once.
+ * Submissions go round robin over the striped WQs, see dsa_stripe_wq(); each
+ * slot remembers its WQ for resubmission. A batch writes its own completion
+ * record into the entry of its first slot, so that a batch the device
+ * refused as a whole is noticed and its members run one by one.
+ *
+ * In dedicated mode movdir64b to a full WQ is dropped without an error:
+ * the queue counts the WQ entries it holds, a batch or a single taking
+ * one, and reaps before submitting to a WQ without room.
+ */
+#define DSA_QUEUE_DEPTH 256
+#define DSA_QUEUE_BATCH 32 // default max_batch_size of a wq
+
+struct dsa_queue
+{
+    struct dsa_hw_desc *desc;           // depth ring slots
+    struct dsa_completion_record *comp; // one per slot
+    struct dsa_completion_record *bcomp; // of the batch starting at the slot
+    struct dsa_wq_info **wq;            // the slot was submitted to
+    unsigned long *batch_len;           // descriptors submitted as one entry from the slot
+    unsigned long inflight[DSA_MAX_WQS]; // WQ entries not reaped yet
+    unsigned long depth;
+    unsigned long batch_size;
+    unsigned long max_xfer;  // smallest max_transfer_size of the WQs
+    unsigned long head;      // next free slot
+    unsigned long submitted; // slots below this are with the device
+    unsigned long tail;      // oldest slot not reaped yet
+    unsigned long batches;   // BATCH descriptors submitted
+    unsigned long singles;   // descriptors submitted on their own
+};
+
+static struct dsa_queue dsa_queue;
+static unsigned long dsa_queue_depth = DSA_QUEUE_DEPTH;
+static unsigned long dsa_queue_batch = DSA_QUEUE_BATCH;
+
+static void dsa_queue_free(struct dsa_queue *q)
+{
+    free(q->desc);
+    free(q->comp);
+    free(q->bcomp);
+    free(q->wq);
+    free(q->batch_len);
+    q->desc = NULL;
+    q->comp = NULL;
+    q->bcomp = NULL;
+    q->wq = NULL;
+    q->batch_len = NULL;
+}
+
+static int dsa_queue_init(struct dsa_queue *q, unsigned long depth, unsigned long batch_size,
+                          unsigned long max_xfer)
+{
+    memset(q, 0, sizeof(*q));
+    q->depth = std::max(1UL, depth);
+    q->batch_size = std::max(1UL, std::min(batch_size, q->depth));
+    q->max_xfer = max_xfer;
+    q->desc = (struct dsa_hw_desc *)aligned_alloc(64, q->depth * sizeof(*q->desc));
+    q->comp = (struct dsa_completion_record *)aligned_alloc(32, q->depth * sizeof(*q->comp));
+    q->bcomp = (struct dsa_completion_record *)aligned_alloc(32, q->depth * sizeof(*q->bcomp));
+    q->wq = (struct dsa_wq_info **)calloc(q->depth, sizeof(*q->wq));
+    q->batch_len = (unsigned long *)calloc(q->depth, sizeof(*q->batch_len));
+    if (!q->desc || !q->comp || !q->bcomp || !q->wq || !q->batch_len)
+    {
+        printf("Failed to allocate a DSA queue of %lu descriptors\n", q->depth);
+        dsa_queue_free(q);
+        return -1;
+    }
+    memset(q->desc, 0, q->depth * sizeof(*q->desc));
+    memset(q->comp, 0, q->depth * sizeof(*q->comp));
+    memset(q->bcomp, 0, q->depth * sizeof(*q->bcomp));
+    return 0;
+}
+
+static unsigned long dsa_queue_reap(struct dsa_queue *q, unsigned long min);
+
+/**
+ * Hand every appended slot to the device: a lone descriptor as is, since
+ * a batch needs at least two, several as BATCHes of at most the WQ's
+ * max_batch whose lists are the ring itself. Members report in their own
+ * slots, the batch in bcomp of its first slot. Waits for a WQ to have room.
+ */
+static void dsa_queue_flush(struct dsa_queue *q)
+{
+    struct dsa_hw_desc batch __attribute__((aligned(64)));
+
+    while (q->submitted < q->head)
+    {
+        struct dsa_wq_info *wq = dsa_stripe_wq(q->batches + q->singles);
+        unsigned long first = q->submitted % q->depth;
+        unsigned long n = std::min(q->head - q->submitted, std::max(1UL, wq->max_batch));
+
+        while (!dsa_wq_has_room(wq, q->inflight))
+            dsa_queue_reap(q, 1);
+        q->inflight[wq - dsa_wqs]++;
+        q->batch_len[first] = n;
+        for (unsigned long i = 0; i < n; i++)
+            q->wq[first + i] = wq;
+        if (n == 1)
+        {
+            submit_wi(wq, &q->desc[first]);
+            q->singles++;
+        }
+        else
+        {
+            memset(&batch, 0, sizeof(batch));
+            memset(&q->bcomp[first], 0, sizeof(q->bcomp[first]));
+            batch.opcode = DSA_OPCODE_BATCH;
+            batch.flags = IDXD_OP_FLAG_RCR | IDXD_OP_FLAG_CRAV;
+            batch.desc_list_addr = (uintptr_t)&q->desc[first];
+            batch.desc_count = n;
+            batch.completion_addr = (uintptr_t)&q->bcomp[first];
+            submit_wi(wq, &batch);
+            q->batches++;
+        }
+        q->submitted += n;
+    }
+}
+
+/**
+ * Wait for the batch starting at slot and give back its WQ entry. When the
+ * device refused it or gave up reading its list, members whose records
+ * were never written did not run: they run one at a time now, each in the
+ * entry the batch just freed.
+ */
+static void dsa_queue_check_batch(struct dsa_queue *q, unsigned long slot)
+{
+    struct dsa_completion_record *bcomp = &q->bcomp[slot];
+    uint8_t status;
+
+    if (poll_completion(bcomp, DSA_OPCODE_BATCH) != 0 && bcomp->status == DSA_COMP_NONE)
+    {
+        printf("DSA queue stalled waiting for a batch of %lu descriptors\n",
+               q->batch_len[slot]);
+        exit(1);
+    }
+    q->inflight[q->wq[slot] - dsa_wqs]--;
+    status = bcomp->status & DSA_COMP_STATUS_MASK;
+    if (status != DSA_COMP_SUCCESS && status != DSA_COMP_BATCH_FAIL)
+    {
+        for (unsigned long i = slot; i < slot + q->batch_len[slot]; i++)
+        {
+            if (q->comp[i].status != DSA_COMP_NONE)
+                continue;
+            submit_wi(q->wq[i], &q->desc[i]);
+            dsa_resubmit(q->wq[i], &q->desc[i], &q->comp[i]);
+            q->singles++;
+        }
+    }
+    q->batch_len[slot] = 0;
+}
+
+/**
+ * Retire finished slots in ring order. Stops at the first unfinished slot
+ * once at least min slots were retired, and waits for it otherwise.
+ *
+ * @return
+ *   Number of slots retired.
+ */
+static unsigned long dsa_queue_reap(struct dsa_queue *q, unsigned long min)
+{
+    unsigned long reaped = 0;
+
+    if (min > q->submitted - q->tail)
+        dsa_queue_flush(q);
+    for (; q->tail < q->submitted; q->tail++, reaped++)
+    {
+        unsigned long slot = q->tail % q->depth;
+        struct dsa_completion_record *comp = &q->comp[slot];
+
+        if (q->batch_len[slot] > 1)
+        {
+            if (q->bcomp[slot].status == DSA_COMP_NONE && reaped >= min)
+                break;
+            dsa_queue_check_batch(q, slot);
+        }
+        if (comp->status == DSA_COMP_NONE)
+        {
+            if (reaped >= min)
+                break;
+            if (poll_completion(comp, DSA_OPCODE_MEMMOVE) != 0 && comp->status == DSA_COMP_NONE)
+            {
+                printf("DSA queue stalled with %lu descriptors outstanding\n", q->submitted - q->tail);
+                exit(1);
+            }
+        }
+        // a single's entry is free now, a resubmission waits in it again
+        if (q->batch_len[slot])
+        {
+            q->inflight[q->wq[slot] - dsa_wqs]--;
+            q->batch_len[slot] = 0;
+        }
+        if (comp->status != DSA_COMP_SUCCESS)
+            dsa_resubmit(q->wq[slot], &q->desc[slot], comp);
+    }
+    return reaped;
+}
+
+/**
+ * Queue a copy, split at the WQs' max_transfer_size. Blocks only while the
+ * ring is full.
+ */
+static void dsa_queue_copy(struct dsa_queue *q, void *dst, const void *src, size_t len)
+{
+    size_t done, xfer;
+
+    dsa_prefault_range(dst, len);
+    for (done = 0; done < len; done += xfer)
+    {
+        unsigned long slot = q->head % q->depth;
+        struct dsa_hw_desc *desc = &q->desc[slot];
+        struct dsa_completion_record *comp = &q->comp[slot];
+
+        xfer = std::min(len - done, q->max_xfer);
+        if (q->head - q->tail == q->depth)
+            dsa_queue_reap(q, 1);
+
+        memset(desc, 0, sizeof(*desc));
+        memset(comp, 0, sizeof(*comp));
+        desc->opcode = DSA_OPCODE_MEMMOVE;
+        desc->flags = dsa_op_flags;
+        desc->xfer_size = xfer;
+        desc->src_addr = (uintptr_t)src + done;
+        desc->dst_addr = (uintptr_t)dst + done;
+        desc->completion_addr = (uintptr_t)comp;
+        q->head++;
+
+        // a batch list is contiguous, so batches also end where the ring wraps
+        if (q->head - q->submitted == q->batch_size || q->head % q->depth == 0)
+            dsa_queue_flush(q);
+    }
+}
+
+/**
+ * Submit what is still appended and wait for everything outstanding.
+ */
+static void dsa_queue_drain(struct dsa_queue *q)
+{
+    dsa_queue_flush(q);
+    dsa_queue_reap(q, q->submitted - q->tail);
+}
+
+/**
+ * copy_func_t front end of dsa_queue, returns as soon as the copy is
+ * queued. The destination is only valid after copy_dsa_queued_drain().
+ */
+static void *copy_dsa_queued(void *dst, const void *src, size_t len)
+{
+    dsa_queue_copy(&dsa_queue, dst, src, len);
+    return NULL;
+}
+
+static void copy_dsa_queued_drain(void)
+{
+    dsa_queue_drain(&dsa_queue);
+}
@@ -0,0 +1,449 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sys/mman.h>
+
+/**
+ * In-process stand-in for DSA work queues, selected with -w soft[:N].
+ *
+ * Each soft WQ queues submitted descriptors in wq_size entries. A pool of
+ * worker threads of its own, one per engine, runs them and writes the
+ * completion records the way the device does: bytes_completed and the
+ * result fields first, the status byte last. Submitting to a full queue
+ * is refused like ENQCMD to a full shared WQ and retried by submit_wi().
+ * A BATCH takes one entry and its members run on the engine that picked
+ * it up.
+ *
+ * Two knobs shape the timing: an entry cannot start before latency_ns
+ * after its submission, and an engine never moves more than bw_mbps MB/s,
+ * i.e. an operation does not complete before its bytes would have moved
+ * at that rate. The work itself is done by the cpu, so a model asking for
+ * more than the host can copy is capped by the host. With 0 engines the
+ * submitting thread executes descriptors on the spot.
+ *
+ * Moves and fills without IDXD_OP_FLAG_CC stream their destination past the
+ * cache as the device writes it to memory, with the flag they store it
+ * temporally, standing in for the LLC allocating writes. Needs AVX2,
+ * otherwise both are plain stores.
+ *
+ * With faults set, an operation without block on fault stops at the first
+ * page of its source or destination that mincore() does not find resident
+ * and reports DSA_COMP_PAGE_FAULT_NOBOF with the bytes moved so far, the
+ * way the device does when the IOMMU has no translation for the page.
+ */
+#define DSA_SOFT_BATCH_MAX 1024 // largest max_batch_size a wq can be configured with
+
+struct dsa_soft_model
+{
+    unsigned long engines;
+    unsigned long wq_size;
+    unsigned long latency_ns; // submission to earliest start
+    unsigned long bw_mbps;    // per engine, 0 -> as fast as the cpu copies
+    unsigned long faults;     // report page faults on non-resident pages
+};
+
+static struct dsa_soft_model dsa_soft_model = {1, 128, 0, 0, 0};
+
+struct dsa_soft_entry
+{
+    struct dsa_hw_desc desc;
+    unsigned long ready_ns;
+};
+
+struct dsa_soft_queue
+{
+    std::mutex lock;
+    std::condition_variable work;
+    std::deque<struct dsa_soft_entry> entries;
+    std::vector<std::thread> engines;
+    bool stop;
+    unsigned long submitted;
+    unsigned long refused; // submissions that found the queue full
+};
+
+// never freed, engines may still reference them until dsa_soft_stop() at exit
+static std::vector<struct dsa_soft_queue *> dsa_soft_queues;
+
+static unsigned long dsa_soft_now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+/**
+ * Wait for the clock to reach deadline without holding the cpu, the
+ * engines may share it with the submitter and the poller.
+ */
+static void dsa_soft_wait_until(unsigned long deadline)
+{
+    while (dsa_soft_now() < deadline)
+        sched_yield();
+}
+
+/**
+ * CRC32C of n bytes the way COPY_CRC and CRCGEN compute it: seed loaded
+ * into the register as is and no final inversion. Other seeds than ~0,
+ * the partial CRC of a resumed operation, differ from it by the seed
+ * difference shifted over n bytes.
+ */
+static uint32_t dsa_soft_crc(uint32_t seed, const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint32_t crc = seed;
+
+    if (cpu_features.avx2)
+        return ~crc32c(buf, n) ^ (seed == ~0U ? 0 : crc32c_multmodp(crc32c_shift_bytes(n), seed ^ ~0U));
+    while (n--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0U - (crc & 1)));
+    }
+    return crc;
+}
+
+static void dsa_soft_complete(const struct dsa_hw_desc *desc, uint8_t status, uint32_t bytes, uint64_t crc,
+                              uint64_t fault_addr = 0)
+{
+    struct dsa_completion_record *comp = (struct dsa_completion_record *)desc->completion_addr;
+
+    if (!(desc->flags & IDXD_OP_FLAG_RCR) || !comp)
+        return;
+    comp->bytes_completed = bytes;
+    comp->fault_addr = fault_addr;
+    comp->crc_val = crc;
+    __atomic_store_n(&comp->status, status, __ATOMIC_RELEASE);
+}
+
+static uint8_t dsa_soft_execute(const struct dsa_hw_desc *desc);
+
+/**
+ * Bytes from addr up to the first page that is not resident, len when all
+ * of them are or residency cannot be told.
+ */
+static size_t dsa_soft_resident(uint64_t addr, size_t len)
+{
+    uintptr_t page = addr & ~4095UL;
+    uintptr_t end = addr + len;
+    unsigned char vec[64];
+
+    while (page < end)
+    {
+        size_t n = std::min((end - page + 4095) / 4096, sizeof(vec));
+
+        if (mincore((void *)page, n * 4096, vec) != 0)
+            return len;
+        for (size_t i = 0; i < n; i++, page += 4096)
+        {
+            if (!(vec[i] & 1))
+                return page <= addr ? 0 : page - addr;
+        }
+    }
+    return len;
+}
+
+/**
+ * Cut *len back to the part of the operation whose pages are resident.
+ *
+ * @return
+ *   0 when nothing faults, otherwise the page fault status to report with
+ *   *fault_addr set.
+ */
+static uint8_t dsa_soft_fault(const struct dsa_hw_desc *desc, uint32_t *len, uint64_t *fault_addr)
+{
+    bool reads = desc->opcode != DSA_OPCODE_MEMFILL;
+    bool writes = desc->opcode != DSA_OPCODE_CRCGEN;
+    size_t src_ok, dst_ok;
+
+    if (desc->flags & IDXD_OP_FLAG_BOF)
+        return 0;
+    switch (desc->opcode)
+    {
+    case DSA_OPCODE_MEMMOVE:
+    case DSA_OPCODE_MEMFILL:
+    case DSA_OPCODE_COPY_CRC:
+    case DSA_OPCODE_CRCGEN:
+        break;
+    default:
+        return 0;
+    }
+    src_ok = reads ? dsa_soft_resident(desc->src_addr, *len) : *len;
+    dst_ok = writes ? dsa_soft_resident(desc->dst_addr, *len) : *len;
+    if (std::min(src_ok, dst_ok) == *len)
+        return 0;
+    *len = std::min(src_ok, dst_ok);
+    if (src_ok <= dst_ok)
+    {
+        *fault_addr = desc->src_addr + src_ok;
+        return DSA_COMP_PAGE_FAULT_NOBOF;
+    }
+    *fault_addr = desc->dst_addr + dst_ok;
+    return DSA_COMP_PAGE_FAULT_NOBOF | DSA_COMP_STATUS_WRITE;
+}
+
+/**
+ * Members run in list order; the batch fails if any of them does.
+ */
+static uint8_t dsa_soft_batch(const struct dsa_hw_desc *desc)
+{
+    const struct dsa_hw_desc *list = (const struct dsa_hw_desc *)desc->desc_list_addr;
+    uint8_t status = DSA_COMP_SUCCESS;
+
+    if (desc->desc_count < 2 || desc->desc_count > DSA_SOFT_BATCH_MAX)
+        return DSA_COMP_DESC_CNT_ERANGE;
+    if (desc->desc_list_addr & 63)
+        return DSA_COMP_DESCLIST_ALIGN;
+    for (uint32_t i = 0; i < desc->desc_count; i++)
+    {
+        if (list[i].opcode == DSA_OPCODE_BATCH)
+        {
+            dsa_soft_complete(&list[i], DSA_COMP_BAD_OPCODE, 0, 0);
+            status = DSA_COMP_BATCH_FAIL;
+        }
+        else if (dsa_soft_execute(&list[i]) != DSA_COMP_SUCCESS)
+            status = DSA_COMP_BATCH_FAIL;
+    }
+    return status;
+}
+
+/**
+ * Run one descriptor and write its completion record, no earlier than the
+ * engine bandwidth allows.
+ *
+ * @return
+ *   The status written.
+ */
+static uint8_t dsa_soft_execute(const struct dsa_hw_desc *desc)
+{
+    uint8_t *dst = (uint8_t *)desc->dst_addr;
+    const uint8_t *src = (const uint8_t *)desc->src_addr;
+    uint32_t len = desc->xfer_size;
+    uint8_t status = DSA_COMP_SUCCESS;
+    uint64_t crc = 0, fault_addr = 0;
+    unsigned long start = dsa_soft_model.bw_mbps ? dsa_soft_now() : 0;
+    uint8_t fault = dsa_soft_model.faults ? dsa_soft_fault(desc, &len, &fault_addr) : 0;
+
+    switch (desc->opcode)
+    {
+    case DSA_OPCODE_NOOP:
+    case DSA_OPCODE_DRAIN:
+        len = 0;
+        break;
+    case DSA_OPCODE_BATCH:
+        status = dsa_soft_batch(desc);
+        len = 0;
+        break;
+    case DSA_OPCODE_MEMMOVE:
+        if (!(desc->flags & IDXD_OP_FLAG_CC) && cpu_features.avx2)
+            _avx_memmove_nt(dst, src, len);
+        else
+            memmove(dst, src, len);
+        break;
+    case DSA_OPCODE_MEMFILL:
+        // fills of one repeated byte, all fill_dsa() issues, can stream
+        if (!(desc->flags & IDXD_OP_FLAG_CC) && cpu_features.avx2 &&
+            desc->pattern == 0x0101010101010101ULL * (uint8_t)desc->pattern)
+        {
+            _avx_fill_nt(dst, (uint8_t)desc->pattern, len);
+            break;
+        }
+        for (uint32_t i = 0; i < len; i += 8)
+        {
+            uint64_t pattern = desc->pattern;
+
+            memcpy(dst + i, &pattern, std::min(8U, len - i));
+        }
+        break;
+    case DSA_OPCODE_COPY_CRC:
+        memcpy(dst, src, len);
+        crc = dsa_soft_crc(desc->crc_seed, dst, len);
+        break;
+    case DSA_OPCODE_CRCGEN:
+        crc = dsa_soft_crc(desc->crc_seed, src, len);
+        break;
+    default:
+        status = DSA_COMP_BAD_OPCODE;
+        len = 0;
+        break;
+    }
+    // a batch's members were charged one by one
+    if (dsa_soft_model.bw_mbps && desc->opcode != DSA_OPCODE_BATCH)
+    {
+        double bytes_per_ns = (double)dsa_soft_model.bw_mbps * 1024 * 1024 / 1000000000.0;
+
+        dsa_soft_wait_until(start + (unsigned long)(len / bytes_per_ns));
+    }
+    if (fault && status == DSA_COMP_SUCCESS)
+        status = fault;
+    dsa_soft_complete(desc, status, len, crc, fault_addr);
+    return status;
+}
+
+static void dsa_soft_engine(struct dsa_soft_queue *q)
+{
+    struct dsa_soft_entry entry;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(q->lock);
+
+            q->work.wait(lock, [q] { return q->stop || !q->entries.empty(); });
+            if (q->entries.empty())
+                return;
+            entry = q->entries.front();
+            q->entries.pop_front();
+        }
+        dsa_soft_wait_until(entry.ready_ns);
+        dsa_soft_execute(&entry.desc);
+    }
+}
+
+/**
+ * Queue a copy of the descriptor, as the portal write does.
+ *
+ * @return
+ *   0 when accepted, 1 when the queue is full and the caller should retry.
+ */
+static int dsa_soft_submit(struct dsa_soft_queue *q, const struct dsa_hw_desc *descriptor)
+{
+    struct dsa_soft_entry entry;
+
+    entry.desc = *descriptor;
+    entry.ready_ns = dsa_soft_now() + dsa_soft_model.latency_ns;
+    if (dsa_soft_model.engines == 0)
+    {
+        q->submitted++;
+        dsa_soft_wait_until(entry.ready_ns);
+        dsa_soft_execute(&entry.desc);
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(q->lock);
+
+        if (q->entries.size() >= dsa_soft_model.wq_size)
+        {
+            q->refused++;
+            return 1;
+        }
+        q->entries.push_back(entry);
+        q->submitted++;
+    }
+    q->work.notify_one();
+    return 0;
+}
+
+/**
+ * Parse a comma separated list of engines=, wq_size=, latency= (ns), bw=
+ * (MB/s per engine) and faults= (0 or 1) into dsa_soft_model.
+ *
+ * @return
+ *   0 on success, -1 on an unknown key.
+ */
+static int dsa_soft_parse(const char *spec)
+{
+    char *copy = strdup(spec);
+    char *save = NULL;
+    int ret = 0;
+
+    for (char *tok = strtok_r(copy, ",", &save); tok && ret == 0; tok = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(tok, '=');
+        unsigned long value;
+
+        if (!eq)
+        {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        value = strtoul(eq + 1, NULL, 0);
+        if (!strcmp(tok, "engines"))
+            dsa_soft_model.engines = value;
+        else if (!strcmp(tok, "wq_size"))
+            dsa_soft_model.wq_size = std::max(1UL, value);
+        else if (!strcmp(tok, "latency"))
+            dsa_soft_model.latency_ns = value;
+        else if (!strcmp(tok, "bw"))
+            dsa_soft_model.bw_mbps = value;
+        else if (!strcmp(tok, "faults"))
+            dsa_soft_model.faults = value;
+        else
+            ret = -1;
+    }
+    free(copy);
+    return ret;
+}
+
+/**
+ * Let the engines finish what was submitted and join them. Runs at exit,
+ * a condition variable with waiters cannot be destroyed.
+ */
+static void dsa_soft_stop(void)
+{
+    for (struct dsa_soft_queue *q : dsa_soft_queues)
+    {
+        {
+            std::lock_guard<std::mutex> lock(q->lock);
+
+            q->stop = true;
+        }
+        q->work.notify_all();
+        for (auto &t : q->engines)
+            t.join();
+        q->engines.clear();
+    }
+}
+
+/**
+ * Append n soft WQs to dsa_wqs, each with its own engines.
+ *
+ * @return
+ *   Number of WQs added.
+ */
+static int dsa_soft_add(int n)
+{
+    int added = 0;
+
+    if (dsa_soft_queues.empty())
+    {
+        // registered after dsa_soft_queues was constructed, so it runs before its destructor
+        atexit(dsa_soft_stop);
+        printf("Soft WQ: %lu engines, %lu entries, %lu ns submission latency, ", dsa_soft_model.engines,
+               dsa_soft_model.wq_size, dsa_soft_model.latency_ns);
+        if (dsa_soft_model.bw_mbps)
+            printf("%lu MB/s per engine", dsa_soft_model.bw_mbps);
+        else
+            printf("unthrottled engines");
+        printf("%s\n", dsa_soft_model.faults ? ", page faults on non-resident pages" : "");
+    }
+    for (; added < n && dsa_nr_wqs < DSA_MAX_WQS; added++)
+    {
+        struct dsa_wq_info *wq = &dsa_wqs[dsa_nr_wqs++];
+        struct dsa_soft_queue *q = new dsa_soft_queue();
+
+        memset(wq, 0, sizeof(*wq));
+        snprintf(wq->name, sizeof(wq->name), "soft%zu", dsa_soft_queues.size());
+        wq->portal = MAP_FAILED;
+        wq->node = NUMA_NODE_ANY;
+        wq->size = dsa_soft_model.wq_size;
+        wq->max_batch = DSA_QUEUE_BATCH;
+        wq->max_xfer = DSA_MAX_XFER;
+        wq->cache_control = true;
+        wq->soft = q;
+        for (unsigned long i = 0; i < dsa_soft_model.engines; i++)
+            q->engines.emplace_back(dsa_soft_engine, q);
+        dsa_soft_queues.push_back(q);
+    }
+    dsa_soft = true;
+    return added;
+}
+
+static void dsa_soft_print_stats(void)
+{
+    for (size_t i = 0; i < dsa_soft_queues.size(); i++)
+        printf("Soft WQ soft%zu: %lu submissions, %lu refused on a full queue\n", i,
+               dsa_soft_queues[i]->submitted, dsa_soft_queues[i]->refused);
+}
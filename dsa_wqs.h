@@ -0,0 +1,263 @@
+#include <dirent.h>
+
+/**
+ * Work queue discovery and striping over several WQs.
+ *
+ * Enabled user WQs are read from the idxd sysfs tree, each with its own
+ * mode, size and limits, and the NUMA node of its device. dsa_order lists
+ * the WQs nearest a node first; the striping paths use its first
+ * dsa_stripe_width entries.
+ */
+#define DSA_SYSFS "/sys/bus/dsa/devices"
+#define DSA_STRIPE_MAX 64     // descriptors of a striped copy in flight at once
+#define DSA_STRIPE_ALIGN 4096 // stripes start on page boundaries
+
+static int dsa_order[DSA_MAX_WQS];
+static int dsa_stripe_width = 1;
+
+static bool dsa_sysfs_read(const char *dir, const char *file, char *buf, size_t len)
+{
+    char path[256];
+    FILE *f;
+    bool ok;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    f = fopen(path, "r");
+    if (!f)
+        return false;
+    ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    if (ok)
+        buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+/**
+ * Fill wq from the sysfs entry of WQ name (wqX.Y). Limits the kernel does
+ * not report keep their defaults, a WQ without sysfs entry is taken as
+ * shared as before discovery existed.
+ *
+ * @return
+ *   0 when the WQ can take user submissions, -1 otherwise.
+ */
+static int dsa_wq_read_config(const char *name, struct dsa_wq_info *wq)
+{
+    char dir[256], buf[64];
+    int dev, idx;
+
+    memset(wq, 0, sizeof(*wq));
+    snprintf(wq->name, sizeof(wq->name), "%s", name);
+    wq->portal = MAP_FAILED;
+    wq->node = NUMA_NODE_ANY;
+    wq->max_batch = 32;
+    wq->max_xfer = DSA_MAX_XFER;
+    wq->cache_control = true;
+    if (sscanf(name, "wq%d.%d", &dev, &idx) != 2)
+        return -1;
+
+    snprintf(dir, sizeof(dir), "%s/%s", DSA_SYSFS, name);
+    if (!dsa_sysfs_read(dir, "state", buf, sizeof(buf)))
+        return 0;
+    if (strcmp(buf, "enabled") != 0)
+        return -1;
+    if (dsa_sysfs_read(dir, "type", buf, sizeof(buf)) && strcmp(buf, "user") != 0)
+        return -1;
+    if (dsa_sysfs_read(dir, "mode", buf, sizeof(buf)))
+        wq->dedicated = !strcmp(buf, "dedicated");
+    if (dsa_sysfs_read(dir, "size", buf, sizeof(buf)))
+        wq->size = strtoul(buf, NULL, 0);
+    if (dsa_sysfs_read(dir, "max_batch_size", buf, sizeof(buf)))
+        wq->max_batch = strtoul(buf, NULL, 0);
+    if (dsa_sysfs_read(dir, "max_transfer_size", buf, sizeof(buf)))
+        wq->max_xfer = strtoul(buf, NULL, 0);
+
+    snprintf(dir, sizeof(dir), "%s/dsa%d", DSA_SYSFS, dev);
+    if (dsa_sysfs_read(dir, "numa_node", buf, sizeof(buf)))
+        wq->node = atoi(buf) < 0 ? NUMA_NODE_ANY : atoi(buf);
+    // GENCAP bit 2: cache control for memory writes
+    if (dsa_sysfs_read(dir, "gen_cap", buf, sizeof(buf)))
+        wq->cache_control = strtoull(buf, NULL, 16) & (1 << 2);
+    return 0;
+}
+
+/**
+ * Map WQ name (wqX.Y, or its /dev/dsa path) and append it to dsa_wqs.
+ *
+ * @return
+ *   0 on success, -1 when it is not usable from this process.
+ */
+static int dsa_add_wq(const char *name)
+{
+    struct dsa_wq_info *wq = &dsa_wqs[dsa_nr_wqs];
+    const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    char path[64];
+
+    if (dsa_nr_wqs == DSA_MAX_WQS)
+        return -1;
+    if (dsa_wq_read_config(base, wq) != 0)
+    {
+        printf("%s is not an enabled user WQ\n", base);
+        return -1;
+    }
+    if (wq->dedicated ? !cpu_features.movdir64b : !cpu_features.enqcmd)
+    {
+        printf("cpu lacks %s, %s skipped\n", wq->dedicated ? "MOVDIR64B" : "ENQCMD", base);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/dev/dsa/%s", base);
+    wq->portal = map_dsa_device(path);
+    if (wq->portal == MAP_FAILED)
+        return -1;
+    dsa_nr_wqs++;
+    return 0;
+}
+
+static int dsa_name_cmp(const void *a, const void *b)
+{
+    return strverscmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/**
+ * Add every enabled user WQ found in sysfs, in device order.
+ *
+ * @return
+ *   Number of WQs added.
+ */
+static int dsa_discover(void)
+{
+    DIR *dir = opendir(DSA_SYSFS);
+    std::vector<char *> names;
+    struct dirent *e;
+    int added = 0;
+
+    if (!dir)
+        return 0;
+    while ((e = readdir(dir)) != NULL)
+    {
+        if (!strncmp(e->d_name, "wq", 2))
+            names.push_back(strdup(e->d_name));
+    }
+    closedir(dir);
+    qsort(names.data(), names.size(), sizeof(char *), dsa_name_cmp);
+    for (char *name : names)
+    {
+        struct dsa_wq_info probe;
+
+        // quietly pass over kernel and disabled WQs, they are not ours to use
+        if (dsa_wq_read_config(name, &probe) == 0 && dsa_add_wq(name) == 0)
+            added++;
+        free(name);
+    }
+    return added;
+}
+
+/**
+ * Order the WQs so that the ones on node come first, keeping discovery
+ * order otherwise, and make the first of them dsa_wq.
+ */
+static void dsa_prefer_node(int node)
+{
+    int n = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < dsa_nr_wqs; i++)
+        {
+            bool local = node != NUMA_NODE_ANY && dsa_wqs[i].node == node;
+
+            if (local == (pass == 0))
+                dsa_order[n++] = i;
+        }
+    }
+    dsa_wq = dsa_nr_wqs ? &dsa_wqs[dsa_order[0]] : NULL;
+    dsa_stripe_width = std::max(1, std::min(dsa_stripe_width, dsa_nr_wqs));
+}
+
+static bool dsa_cache_control_supported(void)
+{
+    for (int i = 0; i < dsa_nr_wqs; i++)
+    {
+        if (!dsa_wqs[i].cache_control)
+            return false;
+    }
+    return dsa_nr_wqs > 0;
+}
+
+static inline struct dsa_wq_info *dsa_stripe_wq(unsigned long i)
+{
+    return &dsa_wqs[dsa_order[i % dsa_stripe_width]];
+}
+
+/**
+ * Whether wq takes one more of the caller's descriptors, used[] counting
+ * those it has in flight per WQ. MOVDIR64B to a full dedicated WQ is
+ * dropped without an error, so nobody submits past a WQ's size.
+ */
+static inline bool dsa_wq_has_room(const struct dsa_wq_info *wq, const unsigned long *used)
+{
+    return used[wq - dsa_wqs] < std::max(1UL, wq->size);
+}
+
+static void dsa_print_wqs(void)
+{
+    for (int i = 0; i < dsa_nr_wqs; i++)
+    {
+        const struct dsa_wq_info *wq = &dsa_wqs[dsa_order[i]];
+
+        printf("  %-8s node %-3d %-9s %lu entries, batches of %lu, %lu KB transfers%s\n", wq->name,
+               wq->node == NUMA_NODE_ANY ? -1 : wq->node, wq->dedicated ? "dedicated" : "shared", wq->size,
+               wq->max_batch, wq->max_xfer / 1024, wq->cache_control ? ", cache control" : "");
+    }
+}
+
+/**
+ * Copy len bytes as dsa_stripe_width page aligned stripes, one per WQ in
+ * preference order, all in flight together. Stripes larger than a WQ's
+ * max_xfer take several descriptors; past DSA_STRIPE_MAX descriptors, or
+ * a WQ's size, the copy proceeds in rounds.
+ */
+static void *copy_dsa_striped(void *dst, const void *src, size_t len)
+{
+    struct dsa_hw_desc desc[DSA_STRIPE_MAX] __attribute__((aligned(64)));
+    struct dsa_completion_record comp[DSA_STRIPE_MAX] __attribute__((aligned(32)));
+    struct dsa_wq_info *sub[DSA_STRIPE_MAX];
+    unsigned long used[DSA_MAX_WQS];
+    size_t stripe = (len + dsa_stripe_width - 1) / dsa_stripe_width;
+    size_t off = 0;
+    int n, i;
+
+    stripe = (stripe + DSA_STRIPE_ALIGN - 1) & ~(size_t)(DSA_STRIPE_ALIGN - 1);
+    dsa_prefault_range(dst, len);
+    while (off < len)
+    {
+        memset(used, 0, sizeof(used));
+        for (n = 0; off < len && n < DSA_STRIPE_MAX; n++)
+        {
+            struct dsa_wq_info *wq = dsa_stripe_wq(off / stripe);
+            size_t end = std::min(len, (off / stripe + 1) * stripe);
+            size_t xfer = std::min(end - off, wq->max_xfer);
+
+            if (!dsa_wq_has_room(wq, used))
+                break;
+            used[wq - dsa_wqs]++;
+            memset(&desc[n], 0, sizeof(desc[n]));
+            memset(&comp[n], 0, sizeof(comp[n]));
+            desc[n].opcode = DSA_OPCODE_MEMMOVE;
+            desc[n].flags = dsa_op_flags;
+            desc[n].xfer_size = xfer;
+            desc[n].src_addr = (uintptr_t)src + off;
+            desc[n].dst_addr = (uintptr_t)dst + off;
+            desc[n].completion_addr = (uintptr_t)&comp[n];
+            sub[n] = wq;
+            submit_wi(wq, &desc[n]);
+            off += xfer;
+        }
+        for (i = 0; i < n; i++)
+        {
+            poll_completion(&comp[i], DSA_OPCODE_MEMMOVE);
+            if (comp[i].status != DSA_COMP_SUCCESS)
+                dsa_resubmit(sub[i], &desc[i], &comp[i]);
+        }
+    }
+    return dst;
+}
@@ -0,0 +1,157 @@
+/**
+ * Fill kernels, memset signature so memset itself is a variant.
+ *
+ * The vector kernels take any d and n: an unaligned store covers the head,
+ * the bulk stores are aligned to the vector width and an overlapping (AVX2)
+ * or masked (AVX-512) store finishes the tail. The NT flavours stream the
+ * bulk past the cache and fence before returning.
+ */
+typedef void *(*fill_func_t)(void *d, int c, size_t n);
+
+static inline void * _rep_stosb(void *d, int c, size_t n)
+{
+    __asm__ __volatile__ (
+        "rep stosb"
+        : "+D" (d), "+c" (n)
+        : "a" (c)
+        : "memory"
+    );
+    return NULL;
+}
+
+template <bool NT_STORE>
+TARGET_AVX2 static inline void _avx_fill_impl(void *dst, int c, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    uint8_t *d_end = d + n;
+    __m256i v = _mm256_set1_epi8((char)c);
+    size_t skew;
+
+    if (n < 64)
+    {
+        // the copy helper only reads what it writes, feed it the pattern
+        uint8_t pattern[64];
+
+        _mm256_storeu_si256((__m256i *)pattern, v);
+        _mm256_storeu_si256((__m256i *)(pattern + 32), v);
+        _avx_cpy_small(d, pattern, n);
+        return;
+    }
+
+    _mm256_storeu_si256((__m256i *)d, v);
+    skew = 32 - ((uintptr_t)d & 31);
+    d += skew;
+    n -= skew;
+    for (; n > 32; n -= 32, d += 32)
+    {
+        if (NT_STORE)
+            _mm256_stream_si256((__m256i *)d, v);
+        else
+            _mm256_store_si256((__m256i *)d, v);
+    }
+    if (NT_STORE)
+        _mm_sfence();
+    _mm256_storeu_si256((__m256i *)(d_end - 32), v);
+}
+
+template <bool NT_STORE>
+TARGET_AVX512 static inline void _avx512_fill_impl(void *dst, int c, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    __m512i v = _mm512_set1_epi8((char)c);
+    size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+
+    if (head)
+    {
+        _mm512_mask_storeu_epi8(d, _avx512_mask(std::min(head, n)), v);
+        if (head >= n)
+            return;
+        d += head;
+        n -= head;
+    }
+    for (; n >= 64; n -= 64, d += 64)
+    {
+        if (NT_STORE)
+            _mm512_stream_si512((__m512i *)d, v);
+        else
+            _mm512_store_si512(d, v);
+    }
+    if (n)
+        _mm512_mask_storeu_epi8(d, _avx512_mask(n), v);
+    if (NT_STORE)
+        _mm_sfence();
+}
+
+TARGET_AVX2 static inline void * _avx_fill(void *d, int c, size_t n)
+{
+    _avx_fill_impl<false>(d, c, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_fill_nt(void *d, int c, size_t n)
+{
+    _avx_fill_impl<true>(d, c, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_fill(void *d, int c, size_t n)
+{
+    _avx512_fill_impl<false>(d, c, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_fill_nt(void *d, int c, size_t n)
+{
+    _avx512_fill_impl<true>(d, c, n);
+    return NULL;
+}
+
+struct fill_impl
+{
+    const char *name;
+    fill_func_t func;
+};
+
+static struct fill_impl fill_impls[8];
+static int fill_nr_impls;
+// fill used to (re)initialize the benchmark buffers, set by fill_init()
+static struct fill_impl buffer_fill = {"memset", memset};
+
+/**
+ * Register the fills this host supports, fastest large-buffer choice first.
+ * Buffer resets are never read back before the next pass overwrites them,
+ * so streaming stores win over temporal ones there. DSA leaves the cpu
+ * idle but is only registered once the work queue is up.
+ */
+static void fill_init(bool use_dsa)
+{
+    fill_nr_impls = 0;
+    if (use_dsa)
+        fill_impls[fill_nr_impls++] = {"dsa", fill_dsa};
+    if (cpu_features.avx512bw)
+        fill_impls[fill_nr_impls++] = {"avx512_nt", _avx512_fill_nt};
+    if (cpu_features.avx2)
+        fill_impls[fill_nr_impls++] = {"avx2_nt", _avx_fill_nt};
+    if (cpu_features.erms)
+        fill_impls[fill_nr_impls++] = {"rep_stosb", _rep_stosb};
+    fill_impls[fill_nr_impls++] = {"memset", memset};
+}
+
+/**
+ * Pick the buffer fill by name, or the first registered one for NULL.
+ *
+ * @return
+ *   0 on success, -1 when name is not available on this host.
+ */
+static int fill_select(const char *name)
+{
+    for (int i = 0; i < fill_nr_impls; i++)
+    {
+        if (!name || !strcmp(name, fill_impls[i].name))
+        {
+            buffer_fill = fill_impls[i];
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,166 @@
+#include <array>
+#include <utility>
+
+/**
+ * Copies whose size is a compile-time constant.
+ *
+ * copy_fixed<N>() resolves every size decision while compiling, so each
+ * instantiation is just the loads and stores for N bytes: one move when N
+ * is a power of two up to the vector width, two overlapping moves of the
+ * next smaller power of two otherwise, and an unrolled run of vectors with
+ * one overlapping vector for the remainder above that. The AVX-512 flavour
+ * replaces the overlapping tail by a single masked move with a constant mask.
+ * Locations must not overlap.
+ */
+// large N exceed the inliner's budget, but the point is to never pay a call
+#define FIXED_INLINE __attribute__((always_inline)) inline
+
+template <size_t W>
+static FIXED_INLINE void copy_word(uint8_t *d, const uint8_t *s)
+{
+    // fixed size memcpy lowers to one mov of W bytes
+    __builtin_memcpy(d, s, W);
+}
+
+/**
+ * Largest power of two strictly below n, for n >= 2.
+ */
+static constexpr size_t fixed_lower_pow2(size_t n)
+{
+    size_t p = 1;
+
+    while (p * 2 < n)
+        p *= 2;
+    return p;
+}
+
+/**
+ * Straight-line moves of the vectors I..., all loads before the stores.
+ * Spelled as pack expansions because a loop over a vector array is turned
+ * back into a memcpy call by the compiler.
+ */
+template <size_t... I>
+TARGET_AVX2 static FIXED_INLINE void copy_vectors_avx2(uint8_t *d, const uint8_t *s, std::index_sequence<I...>)
+{
+    __m256i v[] = {_mm256_loadu_si256((const __m256i *)s + I)...};
+
+    (_mm256_storeu_si256((__m256i *)d + I, v[I]), ...);
+}
+
+template <size_t... I>
+TARGET_AVX512 static FIXED_INLINE void copy_vectors_avx512(uint8_t *d, const uint8_t *s, std::index_sequence<I...>)
+{
+    __m512i v[] = {_mm512_loadu_si512(s + I * 64)...};
+
+    (_mm512_storeu_si512(d + I * 64, v[I]), ...);
+}
+
+template <size_t N>
+TARGET_AVX2 static FIXED_INLINE void copy_fixed(void *dst, const void *src)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if constexpr (N == 0)
+        return;
+    else if constexpr (N <= 16 && (N & (N - 1)) == 0)
+        copy_word<N>(d, s);
+    else if constexpr (N < 16)
+    {
+        constexpr size_t P = fixed_lower_pow2(N);
+
+        copy_word<P>(d, s);
+        copy_word<P>(d + N - P, s + N - P);
+    }
+    else if constexpr (N < 32)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + N - 16));
+
+        _mm_storeu_si128((__m128i *)d, a);
+        _mm_storeu_si128((__m128i *)(d + N - 16), b);
+    }
+    else
+    {
+        // the tail is loaded first, it may overlap the last whole vector
+        __m256i tail = _mm256_loadu_si256((const __m256i *)(s + N - 32));
+
+        copy_vectors_avx2(d, s, std::make_index_sequence<N / 32>());
+        if constexpr (N % 32)
+            _mm256_storeu_si256((__m256i *)(d + N - 32), tail);
+    }
+}
+
+template <size_t N>
+TARGET_AVX512 static FIXED_INLINE void copy_fixed_avx512(void *dst, const void *src)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if constexpr (N < 64)
+    {
+        // below a full zmm the masked move costs more than the narrow moves
+        copy_fixed<N>(dst, src);
+    }
+    else
+    {
+        constexpr size_t V = N / 64;
+        constexpr __mmask64 M = (N % 64) ? (1ULL << (N % 64)) - 1 : 0;
+
+        copy_vectors_avx512(d, s, std::make_index_sequence<V>());
+        if constexpr (M != 0)
+            _mm512_mask_storeu_epi8(d + V * 64, M, _mm512_maskz_loadu_epi8(M, s + V * 64));
+    }
+}
+
+/**
+ * Benchmark bodies: iters copies of N bytes, walking window slots of
+ * stride bytes so consecutive copies do not hit the same lines. window must
+ * be a power of two. The size is a constant inside each instantiation, the
+ * loop is what gets timed. n is only read by the runtime sized bodies
+ * sharing this signature.
+ */
+typedef void (*fixed_bench_func_t)(uint8_t *d, const uint8_t *s, size_t stride,
+                                   unsigned long window, unsigned long iters, size_t n);
+
+template <size_t N>
+TARGET_AVX2 static void fixed_bench_avx2(uint8_t *d, const uint8_t *s, size_t stride,
+                                         unsigned long window, unsigned long iters, size_t)
+{
+    for (unsigned long i = 0; i < iters; i++)
+    {
+        size_t off = (i & (window - 1)) * stride;
+        copy_fixed<N>(d + off, s + off);
+    }
+}
+
+template <size_t N>
+TARGET_AVX512 static void fixed_bench_avx512(uint8_t *d, const uint8_t *s, size_t stride,
+                                             unsigned long window, unsigned long iters, size_t)
+{
+    for (unsigned long i = 0; i < iters; i++)
+    {
+        size_t off = (i & (window - 1)) * stride;
+        copy_fixed_avx512<N>(d + off, s + off);
+    }
+}
+
+#define FIXED_COPY_MAX 512
+
+template <size_t... I>
+static constexpr std::array<fixed_bench_func_t, sizeof...(I)> fixed_bench_table_avx2(std::index_sequence<I...>)
+{
+    return {{fixed_bench_avx2<I>...}};
+}
+
+template <size_t... I>
+static constexpr std::array<fixed_bench_func_t, sizeof...(I)> fixed_bench_table_avx512(std::index_sequence<I...>)
+{
+    return {{fixed_bench_avx512<I>...}};
+}
+
+// indexed by N, 0..FIXED_COPY_MAX
+static const std::array<fixed_bench_func_t, FIXED_COPY_MAX + 1> fixed_bench_avx2_funcs =
+    fixed_bench_table_avx2(std::make_index_sequence<FIXED_COPY_MAX + 1>());
+static const std::array<fixed_bench_func_t, FIXED_COPY_MAX + 1> fixed_bench_avx512_funcs =
+    fixed_bench_table_avx512(std::make_index_sequence<FIXED_COPY_MAX + 1>());
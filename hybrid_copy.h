@@ -0,0 +1,137 @@
+#include <atomic>
+
+/**
+ * Copies split between DSA and the calling cpu.
+ *
+ * copy_dsa() leaves the submitting core spinning while the device moves
+ * the data. copy_hybrid() hands the front of a large copy to the WQs
+ * instead and copies the back on the cpu meanwhile, so both finish
+ * together when the split matches their speeds. The cpu part is copied in
+ * HYBRID_SLICE pieces with a look at the completion records in between,
+ * which times the DSA part without waiting for it. After each copy the
+ * split of its size class (a power of two) moves a quarter of the way
+ * toward the ratio of the two measured throughputs. Copy threads share
+ * the classes, their updates are atomic.
+ */
+#define HYBRID_MIN (256UL << 10)  // below this the submission round trip dominates
+#define HYBRID_SLICE (64UL << 10) // cpu work between completion checks
+#define HYBRID_MAX_DESC 64
+#define HYBRID_GRAIN 4096UL // the split falls on page boundaries
+
+struct hybrid_class
+{
+    std::atomic<double> ratio; // share of the copy given to DSA
+    std::atomic<unsigned long> calls;
+};
+
+static struct hybrid_class hybrid_classes[64];
+static copy_func_t hybrid_cpu_copy = memcpy;
+
+static void hybrid_init(void)
+{
+    if (cpu_features.avx2)
+        hybrid_cpu_copy = _avx_async_pf_cpy_unroll_any;
+    for (int i = 0; i < 64; i++)
+    {
+        hybrid_classes[i].ratio.store(0.5, std::memory_order_relaxed);
+        hybrid_classes[i].calls.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Advance *done past every record reporting success. A fault stops it, the
+ * DSA part then only counts as done once dsa_resubmit() has finished it.
+ *
+ * @return
+ *   true once all n are complete.
+ */
+static inline bool hybrid_dsa_done(const struct dsa_completion_record *comp, int n, int *done)
+{
+    while (*done < n && comp[*done].status == DSA_COMP_SUCCESS)
+        (*done)++;
+    return *done == n;
+}
+
+static void *copy_hybrid(void *dst, const void *src, size_t len)
+{
+    struct dsa_hw_desc desc[HYBRID_MAX_DESC] __attribute__((aligned(64)));
+    struct dsa_completion_record comp[HYBRID_MAX_DESC] __attribute__((aligned(32)));
+    struct dsa_wq_info *sub[HYBRID_MAX_DESC];
+    unsigned long used[DSA_MAX_WQS] = {};
+    struct hybrid_class *hc = &hybrid_classes[63 - __builtin_clzl(len | 1)];
+    size_t dsa_len, off;
+    uint64_t start, cpu_cycles, dsa_cycles = 0;
+    double dsa_rate, cpu_rate, share, ratio, next;
+    int n = 0, done = 0;
+
+    if (len < HYBRID_MIN)
+        return hybrid_cpu_copy(dst, src, len);
+
+    dsa_len = (size_t)(len * hc->ratio.load(std::memory_order_relaxed)) & ~(HYBRID_GRAIN - 1);
+    dsa_len = std::min(std::max(dsa_len, HYBRID_GRAIN), len - HYBRID_GRAIN);
+    dsa_prefault_range(dst, dsa_len);
+    start = __rdtsc();
+    for (off = 0; off < dsa_len && n < HYBRID_MAX_DESC; n++)
+    {
+        struct dsa_wq_info *wq = dsa_stripe_wq(n);
+        size_t xfer = std::min(dsa_len - off, wq->max_xfer);
+
+        if (!dsa_wq_has_room(wq, used))
+            break;
+        used[wq - dsa_wqs]++;
+        memset(&desc[n], 0, sizeof(desc[n]));
+        memset(&comp[n], 0, sizeof(comp[n]));
+        desc[n].opcode = DSA_OPCODE_MEMMOVE;
+        desc[n].flags = dsa_op_flags;
+        desc[n].xfer_size = xfer;
+        desc[n].src_addr = (uintptr_t)src + off;
+        desc[n].dst_addr = (uintptr_t)dst + off;
+        desc[n].completion_addr = (uintptr_t)&comp[n];
+        sub[n] = wq;
+        submit_wi(wq, &desc[n]);
+        off += xfer;
+    }
+    // whatever did not fit in HYBRID_MAX_DESC descriptors or the WQs goes to the cpu
+    dsa_len = off;
+
+    for (off = dsa_len; off < len; off += HYBRID_SLICE)
+    {
+        hybrid_cpu_copy((char *)dst + off, (const char *)src + off, std::min(HYBRID_SLICE, len - off));
+        if (!dsa_cycles && hybrid_dsa_done(comp, n, &done))
+            dsa_cycles = __rdtsc() - start;
+    }
+    cpu_cycles = __rdtsc() - start;
+
+    for (int i = 0; i < n; i++)
+    {
+        poll_completion(&comp[i], DSA_OPCODE_MEMMOVE);
+        if (comp[i].status != DSA_COMP_SUCCESS)
+            dsa_resubmit(sub[i], &desc[i], &comp[i]);
+    }
+    if (!dsa_cycles)
+        dsa_cycles = __rdtsc() - start;
+
+    dsa_rate = (double)dsa_len / std::max(dsa_cycles, (uint64_t)1);
+    cpu_rate = (double)(len - dsa_len) / std::max(cpu_cycles, (uint64_t)1);
+    share = dsa_rate / (dsa_rate + cpu_rate);
+    ratio = hc->ratio.load(std::memory_order_relaxed);
+    do
+    {
+        next = std::min(std::max(ratio + (share - ratio) / 4, 0.02), 0.98);
+    } while (!hc->ratio.compare_exchange_weak(ratio, next, std::memory_order_relaxed));
+    hc->calls.fetch_add(1, std::memory_order_relaxed);
+    return dst;
+}
+
+/**
+ * Share of each size class copy_hybrid() settled on.
+ */
+static void hybrid_print(void)
+{
+    for (int i = 0; i < 64; i++)
+    {
+        if (hybrid_classes[i].calls)
+            printf("copy_hybrid %lu KB class: %.0f%% on DSA after %lu copies\n", (1UL << i) / 1024,
+                   hybrid_classes[i].ratio.load() * 100, hybrid_classes[i].calls.load());
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * Log-linear latency histogram in the spirit of HdrHistogram.
+ *
+ * Values below HIST_SUB_BUCKETS get one bucket each. Above that every
+ * power-of-two range is split into HIST_SUB_BUCKETS linear buckets, which
+ * bounds the relative error of a reported value to 1 / HIST_SUB_BUCKETS
+ * over the whole 64-bit range with a fixed 15 KB footprint.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + (64 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+struct latency_hist
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+static inline int hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < HIST_SUB_BUCKETS)
+        return (int)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return HIST_SUB_BUCKETS + shift * HIST_SUB_BUCKETS + (int)((v >> shift) - HIST_SUB_BUCKETS);
+}
+
+/**
+ * Highest value that maps to bucket idx.
+ */
+static inline uint64_t hist_bucket_value(int idx)
+{
+    int shift;
+    uint64_t top;
+
+    if (idx < HIST_SUB_BUCKETS)
+        return idx;
+    shift = (idx - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS;
+    top = HIST_SUB_BUCKETS + (idx - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
+
+static void hist_reset(struct latency_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static inline void hist_record(struct latency_hist *h, uint64_t v, uint64_t count = 1)
+{
+    h->counts[hist_index(v)] += count;
+    h->total += count;
+    if (v > h->max)
+        h->max = v;
+}
+
+/**
+ * Value at or below which pct percent of the recorded samples fall.
+ */
+static uint64_t hist_percentile(const struct latency_hist *h, double pct)
+{
+    uint64_t target = (uint64_t)(pct / 100.0 * h->total + 0.5);
+    uint64_t seen = 0;
+
+    if (target == 0)
+        target = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= target)
+            return std::min(hist_bucket_value(i), h->max);
+    }
+    return h->max;
+}
@@ -0,0 +1,218 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MAX_NUMA_NODES 64
+#define NUMA_NODE_ANY (-1)
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+enum page_backing
+{
+    PAGE_BACKING_4K,  // regular pages, THP disabled for the mapping
+    PAGE_BACKING_THP, // transparent huge pages requested via madvise
+    PAGE_BACKING_2M,  // hugetlbfs 2 MB pages, needs vm.nr_hugepages
+    PAGE_BACKING_1G,  // hugetlbfs 1 GB pages, needs reserved gigantic pages
+    PAGE_BACKING_MAX,
+};
+
+static const char *page_backing_names[PAGE_BACKING_MAX] = {"4k", "thp", "2m", "1g"};
+static enum page_backing page_backing = PAGE_BACKING_4K;
+static bool prefault = false; // populate each slice in bulk before its first touch
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static int parse_page_backing(const char *name)
+{
+    for (int i = 0; i < PAGE_BACKING_MAX; i++)
+    {
+        if (!strcmp(name, page_backing_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Parse a sysfs cpu/node list such as "0-3,8,10-11" into a bitmap.
+ *
+ * @return
+ *   Number of entries set, or -1 if the file cannot be read.
+ */
+static int parse_sysfs_list(const char *path, bool *set, int max)
+{
+    FILE *f = fopen(path, "r");
+    int count = 0;
+    int lo, hi;
+    char sep;
+
+    if (!f)
+        return -1;
+
+    while (fscanf(f, "%d", &lo) == 1)
+    {
+        hi = lo;
+        sep = fgetc(f);
+        if (sep == '-')
+        {
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+            sep = fgetc(f);
+        }
+        for (int i = lo; i <= hi && i < max; i++)
+        {
+            set[i] = true;
+            count++;
+        }
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return count;
+}
+
+/**
+ * Collect online NUMA nodes that have memory. Machines without NUMA sysfs
+ * (or kernels built without NUMA) report a single node 0.
+ */
+static int numa_nodes(int *nodes, int max)
+{
+    bool set[MAX_NUMA_NODES] = {false};
+    int n = 0;
+
+    if (parse_sysfs_list("/sys/devices/system/node/has_memory", set, MAX_NUMA_NODES) <= 0 &&
+        parse_sysfs_list("/sys/devices/system/node/online", set, MAX_NUMA_NODES) <= 0)
+    {
+        nodes[0] = 0;
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_NUMA_NODES && n < max; i++)
+    {
+        if (set[i])
+            nodes[n++] = i;
+    }
+    return n;
+}
+
+/**
+ * Restrict the calling thread to the cpus of a NUMA node.
+ */
+static int bind_thread_to_node(int node)
+{
+    bool cpus[CPU_SETSIZE] = {false};
+    char path[128];
+    cpu_set_t set;
+
+    if (node == NUMA_NODE_ANY)
+        return 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (parse_sysfs_list(path, cpus, CPU_SETSIZE) <= 0)
+    {
+        printf("node %d has no cpus, thread left unbound\n", node);
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        if (cpus[i])
+            CPU_SET(i, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        printf("sched_setaffinity node %d failed with errno = %d.\n", node, errno);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Bind a not yet touched mapping to a NUMA node. Failure is not fatal, the
+ * pages are then placed by the default first-touch policy.
+ */
+static int bind_memory_to_node(void *ptr, size_t size, int node)
+{
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+
+    if (node == NUMA_NODE_ANY)
+        return 0;
+    if (node < 0 || node >= MAX_NUMA_NODES)
+    {
+        printf("invalid NUMA node %d\n", node);
+        return -1;
+    }
+
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, ptr, size, MPOL_BIND, mask, MAX_NUMA_NODES + 1, MPOL_MF_STRICT) != 0)
+    {
+        printf("mbind node %d failed with errno = %d.\n", node, errno);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Map an anonymous buffer with the current page_backing, optionally bound
+ * to a NUMA node. size must be a multiple of the backing page size.
+ *
+ * @return
+ *   The mapping, or NULL when huge pages are not available. Failure to map
+ *   regular pages is fatal.
+ */
+static void *allocate(size_t size, int node = NUMA_NODE_ANY)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS; // Private mapping, not backed by file
+    void *ptr;
+
+    if (page_backing == PAGE_BACKING_2M)
+        flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+    else if (page_backing == PAGE_BACKING_1G)
+        flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+
+    ptr = mmap(
+        nullptr,                // Let OS choose the address
+        size,                   // Size of mapping
+        PROT_READ | PROT_WRITE, // Read and write permissions
+        flags,
+        -1, // File descriptor (not used with MAP_ANONYMOUS)
+        0   // Offset (not used with MAP_ANONYMOUS)
+    );
+
+    if (ptr == MAP_FAILED)
+    {
+        if (page_backing == PAGE_BACKING_2M || page_backing == PAGE_BACKING_1G)
+        {
+            printf("failed to allocate %zu bytes of %s huge pages with errno = %d, "
+                   "check /sys/kernel/mm/hugepages\n",
+                   size, page_backing_names[page_backing], errno);
+            return NULL;
+        }
+        printf("failed to allocate\n");
+        exit(1);
+    }
+
+    // hint must be given before first touch to take effect
+    if (page_backing == PAGE_BACKING_THP && madvise(ptr, size, MADV_HUGEPAGE) != 0)
+        printf("madvise MADV_HUGEPAGE failed with errno = %d.\n", errno);
+    else if (page_backing == PAGE_BACKING_4K)
+        madvise(ptr, size, MADV_NOHUGEPAGE);
+
+    // no MAP_POPULATE: the binding and the THP hint must be in place first,
+    // and the first touch threads populate their own slices, see prefault
+    bind_memory_to_node(ptr, size, node);
+    return ptr;
+}
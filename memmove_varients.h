@@ -0,0 +1,218 @@
+/**
+ * memmove kernels: d and s may overlap.
+ *
+ * The direction follows the overlap. When d lies below s, or the ranges are
+ * disjoint, the copy runs forward; when d lies inside (s, s + n) it runs
+ * backward from the end so no source byte is overwritten before it is
+ * read. Head and tail vectors are loaded before the first store and written
+ * last, which lets the bulk loop use aligned destination stores. The NT
+ * flavours stream the bulk and fence before the temporal head/tail stores.
+ */
+
+/**
+ * True when a forward copy would overwrite source bytes it has yet to read.
+ */
+static inline bool move_needs_backward(const void *d, const void *s, size_t n)
+{
+    return (uintptr_t)d - (uintptr_t)s < n && d != s;
+}
+
+/**
+ * rep movsb forward when that is safe, with DF set otherwise. The backward
+ * form gets no fast-string microcode on current cores and moves a byte per
+ * iteration, it is here to be measured against the SIMD kernels.
+ */
+static inline void * _rep_movsb_move(void *d, const void *s, size_t n)
+{
+    if (!move_needs_backward(d, s, n))
+        return _rep_movsb(d, s, n);
+
+    uint8_t *dl = (uint8_t *)d + n - 1;       // last byte, rep movsb walks down with DF set
+    const uint8_t *sl = (const uint8_t *)s + n - 1;
+
+    __asm__ __volatile__ (
+        "std\n"
+        "rep movsb\n"
+        "cld"
+        : "+D" (dl), "+S" (sl), "+c" (n)
+        :
+        : "memory"
+    );
+    return NULL;
+}
+
+template <bool NT_STORE>
+TARGET_AVX2 static inline void _avx_memmove_impl(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    __m256i head, tail;
+
+    if (n <= 64)
+    {
+        _avx_cpy_small(d, s, n);
+        return;
+    }
+
+    head = _mm256_loadu_si256((const __m256i *)s);
+    tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+
+    if (!move_needs_backward(d, s, n))
+    {
+        size_t skew = 32 - ((uintptr_t)d & 31);
+        uint8_t *dp = d + skew;
+        const uint8_t *sp = s + skew;
+        size_t left = n - skew;
+
+        for (; left > 32; left -= 32, sp += 32, dp += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)sp);
+            if (NT_STORE)
+                _mm256_stream_si256((__m256i *)dp, v);
+            else
+                _mm256_store_si256((__m256i *)dp, v);
+        }
+    }
+    else
+    {
+        size_t skew = ((uintptr_t)(d + n) & 31) ? ((uintptr_t)(d + n) & 31) : 32;
+        uint8_t *dp = d + n - skew;
+        const uint8_t *sp = s + n - skew;
+        size_t left = n - skew;
+
+        for (; left > 32; left -= 32)
+        {
+            sp -= 32;
+            dp -= 32;
+            __m256i v = _mm256_loadu_si256((const __m256i *)sp);
+            if (NT_STORE)
+                _mm256_stream_si256((__m256i *)dp, v);
+            else
+                _mm256_store_si256((__m256i *)dp, v);
+        }
+    }
+    if (NT_STORE)
+        _mm_sfence();
+
+    _mm256_storeu_si256((__m256i *)d, head);
+    _mm256_storeu_si256((__m256i *)(d + n - 32), tail);
+}
+
+template <bool NT_STORE>
+TARGET_AVX512 static inline void _avx512_memmove_impl(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    __m512i head, tail;
+
+    if (n <= 64)
+    {
+        __mmask64 m = _avx512_mask(n);
+
+        _mm512_mask_storeu_epi8(d, m, _mm512_maskz_loadu_epi8(m, s));
+        return;
+    }
+
+    head = _mm512_loadu_si512(s);
+    tail = _mm512_loadu_si512(s + n - 64);
+
+    if (!move_needs_backward(d, s, n))
+    {
+        size_t skew = 64 - ((uintptr_t)d & 63);
+        uint8_t *dp = d + skew;
+        const uint8_t *sp = s + skew;
+        size_t left = n - skew;
+
+        for (; left > 64; left -= 64, sp += 64, dp += 64)
+        {
+            __m512i v = _mm512_loadu_si512(sp);
+            if (NT_STORE)
+                _mm512_stream_si512((__m512i *)dp, v);
+            else
+                _mm512_store_si512(dp, v);
+        }
+    }
+    else
+    {
+        size_t skew = ((uintptr_t)(d + n) & 63) ? ((uintptr_t)(d + n) & 63) : 64;
+        uint8_t *dp = d + n - skew;
+        const uint8_t *sp = s + n - skew;
+        size_t left = n - skew;
+
+        for (; left > 64; left -= 64)
+        {
+            sp -= 64;
+            dp -= 64;
+            __m512i v = _mm512_loadu_si512(sp);
+            if (NT_STORE)
+                _mm512_stream_si512((__m512i *)dp, v);
+            else
+                _mm512_store_si512(dp, v);
+        }
+    }
+    if (NT_STORE)
+        _mm_sfence();
+
+    _mm512_storeu_si512(d, head);
+    _mm512_storeu_si512(d + n - 64, tail);
+}
+
+TARGET_AVX2 static inline void * _avx_memmove(void *d, const void *s, size_t n)
+{
+    _avx_memmove_impl<false>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX2 static inline void * _avx_memmove_nt(void *d, const void *s, size_t n)
+{
+    _avx_memmove_impl<true>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_memmove(void *d, const void *s, size_t n)
+{
+    _avx512_memmove_impl<false>(d, s, n);
+    return NULL;
+}
+
+TARGET_AVX512 static inline void * _avx512_memmove_nt(void *d, const void *s, size_t n)
+{
+    _avx512_memmove_impl<true>(d, s, n);
+    return NULL;
+}
+
+/**
+ * Move each size 1, 63 and 64 bytes down and up inside a patterned buffer
+ * and compare the whole buffer with memmove doing the same on a copy, so a
+ * kernel running the wrong way or touching bytes outside the move fails.
+ */
+static bool memmove_check(copy_func_t func)
+{
+    static const size_t sizes[] = {1, 31, 63, 64, 65, 100, 4096, 8192 + 95, 65536 + 13};
+    static const size_t distances[] = {1, 63, 64};
+    size_t max = 65536 + 13 + 64;
+    uint8_t *buf = (uint8_t *)malloc(max);
+    uint8_t *ref = (uint8_t *)malloc(max);
+    bool ok = buf && ref;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && ok; i++)
+    {
+        for (size_t j = 0; j < sizeof(distances) / sizeof(distances[0]) && ok; j++)
+        {
+            for (int up = 0; up < 2 && ok; up++)
+            {
+                size_t src = up ? 0 : distances[j];
+                size_t dst = up ? distances[j] : 0;
+
+                for (size_t k = 0; k < max; k++)
+                    buf[k] = ref[k] = (uint8_t)(k * 131 + (k >> 7));
+                func(buf + dst, buf + src, sizes[i]);
+                memmove(ref + dst, ref + src, sizes[i]);
+                ok = memcmp(buf, ref, max) == 0;
+            }
+        }
+    }
+    free(buf);
+    free(ref);
+    return ok;
+}
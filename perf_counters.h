@@ -0,0 +1,190 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define PERF_HW_CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+struct perf_event_desc
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int group; // events of one group are scheduled on the PMU together
+};
+
+/**
+ * Generic kernel events, mapped to the model specific encodings by perf.
+ * node-* count demand accesses that reached memory (offcore responses on
+ * Intel), which is the closest portable proxy for DRAM bandwidth.
+ */
+static const struct perf_event_desc perf_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+    {"LLC-load-misses", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+    {"LLC-store-misses", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+    {"dTLB-load-misses", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 2},
+    {"dTLB-store-misses", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS), 2},
+    {"node-loads", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS), 3},
+    {"node-stores", PERF_TYPE_HW_CACHE,
+     PERF_HW_CACHE(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_ACCESS), 3},
+};
+
+#define PERF_NR_EVENTS (int)(sizeof(perf_events) / sizeof(perf_events[0]))
+#define PERF_NR_GROUPS 4
+
+static int perf_fds[PERF_NR_EVENTS];
+static int perf_leaders[PERF_NR_GROUPS];
+static uint64_t perf_values[PERF_NR_EVENTS];
+static bool perf_valid[PERF_NR_EVENTS];
+static bool perf_enabled = false;
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+    // calling thread, any cpu
+    return syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+/**
+ * Open every event the kernel and PMU accept. Unsupported events are
+ * skipped; if none can be opened (no PMU in the VM, perf_event_paranoid,
+ * seccomp in containers) counters are left disabled and copies still run.
+ */
+static int perf_counters_open(void)
+{
+    int opened = 0, last_errno = 0;
+
+    for (int g = 0; g < PERF_NR_GROUPS; g++)
+        perf_leaders[g] = -1;
+
+    for (int i = 0; i < PERF_NR_EVENTS; i++)
+    {
+        struct perf_event_attr attr;
+        int leader = perf_leaders[perf_events[i].group];
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = leader == -1;
+        attr.exclude_kernel = 1; // allowed up to perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        perf_fds[i] = perf_event_open(&attr, leader);
+        if (perf_fds[i] < 0)
+        {
+            last_errno = errno;
+            continue;
+        }
+        if (leader == -1)
+            perf_leaders[perf_events[i].group] = perf_fds[i];
+        opened++;
+    }
+
+    if (opened == 0)
+    {
+        printf("perf_event_open failed with errno = %d, counters disabled%s\n", last_errno,
+               last_errno == EACCES || last_errno == EPERM ? " (check /proc/sys/kernel/perf_event_paranoid)" : "");
+        return -1;
+    }
+
+    for (int i = 0; i < PERF_NR_EVENTS; i++)
+    {
+        if (perf_fds[i] < 0)
+            printf("perf event %s not available\n", perf_events[i].name);
+    }
+    perf_enabled = true;
+    return 0;
+}
+
+static void perf_counters_start(void)
+{
+    if (!perf_enabled)
+        return;
+    for (int g = 0; g < PERF_NR_GROUPS; g++)
+    {
+        if (perf_leaders[g] < 0)
+            continue;
+        ioctl(perf_leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+/**
+ * Stop the groups and read them into perf_values. Groups the PMU had to
+ * multiplex are scaled by enabled/running time; a group that never ran is
+ * marked invalid.
+ */
+static void perf_counters_stop(void)
+{
+    struct
+    {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[PERF_NR_EVENTS];
+    } data;
+
+    if (!perf_enabled)
+        return;
+
+    for (int i = 0; i < PERF_NR_EVENTS; i++)
+        perf_valid[i] = false;
+
+    for (int g = 0; g < PERF_NR_GROUPS; g++)
+    {
+        int member = 0;
+
+        if (perf_leaders[g] < 0)
+            continue;
+        ioctl(perf_leaders[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (read(perf_leaders[g], &data, sizeof(data)) <= 0 || data.time_running == 0)
+            continue;
+
+        // values come back in the order the events joined the group
+        for (int i = 0; i < PERF_NR_EVENTS && member < (int)data.nr; i++)
+        {
+            if (perf_events[i].group != g || perf_fds[i] < 0)
+                continue;
+            perf_values[i] = (uint64_t)((double)data.values[member++] * data.time_enabled / data.time_running);
+            perf_valid[i] = true;
+        }
+    }
+}
+
+static void perf_counters_print(unsigned long bytes)
+{
+    if (!perf_enabled)
+        return;
+
+    printf("\t");
+    if (perf_valid[0] && bytes)
+        printf("cycles/B %.3f  ", (double)perf_values[0] / bytes);
+    if (perf_valid[0] && perf_valid[1] && perf_values[0])
+        printf("IPC %.2f  ", (double)perf_values[1] / perf_values[0]);
+    for (int i = 1; i < PERF_NR_EVENTS; i++)
+    {
+        if (perf_valid[i])
+            printf("%s %lu  ", perf_events[i].name, (unsigned long)perf_values[i]);
+        else
+            printf("%s n/a  ", perf_events[i].name);
+    }
+    printf("\n");
+}
+
+static void perf_counters_close(void)
+{
+    for (int i = 0; i < PERF_NR_EVENTS && perf_enabled; i++)
+    {
+        if (perf_fds[i] >= 0)
+            close(perf_fds[i]);
+    }
+    perf_enabled = false;
+}
@@ -13,10 +13,97 @@
  * @return
  *   Pointer to the destination data.
  */
-static inline void *
+TARGET_AVX512 static inline void *
 rte_memcpy(void *dst, const void *src, size_t n);
 
-static inline void *
+/**
+ * Copies of at least rte_nt_threshold bytes bypass the cache with
+ * non-temporal stores. Set by rte_memcpy_init() from the LLC share of
+ * the calling cpu, never reached until then.
+ */
+static size_t rte_nt_threshold = SIZE_MAX;
+static size_t rte_llc_share = 0;
+
+/**
+ * Size in bytes of the last level cache seen by cpu and the number of cpus
+ * sharing it, from the sysfs cache topology.
+ *
+ * @return
+ *   0 on success, -1 when sysfs does not describe the caches.
+ */
+static int rte_llc_info(int cpu, size_t *size, int *sharing)
+{
+    char path[128];
+    int index, best_level = 0;
+
+    for (index = 0;; index++)
+    {
+        bool shared[1024];
+        char type[32], unit = 'K';
+        unsigned long kb;
+        int level;
+        FILE *f;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        f = fopen(path, "r");
+        if (!f)
+            break;
+        if (fscanf(f, "%d", &level) != 1)
+            level = 0;
+        fclose(f);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, index);
+        f = fopen(path, "r");
+        if (!f || fscanf(f, "%31s", type) != 1 || !strcmp(type, "Instruction") || level <= best_level)
+        {
+            if (f)
+                fclose(f);
+            continue;
+        }
+        fclose(f);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+        f = fopen(path, "r");
+        if (!f)
+            continue;
+        if (fscanf(f, "%lu%c", &kb, &unit) < 1)
+            kb = 0;
+        fclose(f);
+        if (kb == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        best_level = level;
+        *size = unit == 'M' ? kb << 20 : unit == 'G' ? kb << 30 : kb << 10;
+        *sharing = std::max(1, parse_sysfs_list(path, shared, 1024));
+    }
+    return best_level ? 0 : -1;
+}
+
+/**
+ * Derive the non-temporal switchover from the last level cache: a copy
+ * larger than llc_fraction of this cpu's share of the LLC would evict more
+ * than it is worth keeping, so it streams instead. The share divides the
+ * LLC by every cpu listed in shared_cpu_list, SMT siblings included.
+ */
+static void rte_memcpy_init(double llc_fraction)
+{
+    size_t llc_size = 0;
+    int sharing = 1;
+    int cpu = sched_getcpu();
+
+    if (rte_llc_info(cpu < 0 ? 0 : cpu, &llc_size, &sharing) != 0)
+    {
+        printf("LLC size not found in sysfs, rte_memcpy keeps temporal stores\n");
+        return;
+    }
+    rte_llc_share = llc_size / sharing;
+    rte_nt_threshold = (size_t)(rte_llc_share * llc_fraction);
+    printf("LLC %lu KB shared by %d cpus, rte_memcpy streams copies from %lu KB\n",
+           (unsigned long)(llc_size / 1024), sharing, (unsigned long)(rte_nt_threshold / 1024));
+}
+
+TARGET_AVX512 static inline void *
 rte_mov15_or_less(void *dst, const void *src, size_t n)
 {
     /**
@@ -30,7 +117,7 @@ rte_mov15_or_less(void *dst, const void *src, size_t n)
  * Copy 16 bytes from one location to another,
  * locations should not overlap.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov16(uint8_t *dst, const uint8_t *src)
 {
     memcpy(dst, src, 16);
@@ -40,38 +127,29 @@ rte_mov16(uint8_t *dst, const uint8_t *src)
  * Copy 32 bytes from one location to another,
  * locations should not overlap.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov32(uint8_t *dst, const uint8_t *src)
 {
-    asm volatile("vmovdqu32 %1,%%zmm1\n\t"
-                 "vmovdqu32 %%zmm1,%0\n\t"
-                 "sfence"
-                 : "=m"(dst)
-                 : "m"(*src));
+    _mm256_storeu_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
 }
 
 /**
  * Copy 64 bytes from one location to another,
  * locations should not overlap.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov64(uint8_t *dst, const uint8_t *src)
 {
-    // asm volatile("vmovdqu64 %1,%%zmm1\n\t"
-    //              "vmovdqu64 %%zmm1,%0\n\t"
-
-    //              : "=m"(dst)
-    //              : "m"(*src));
-
-    memcpy(dst, src, 64);
-    // check why assembly gives segfault?
+    // the former inline asm used "=m"(dst) and so stored the zmm register
+    // over the pointer variable itself, which is what crashed
+    _mm512_storeu_si512(dst, _mm512_loadu_si512(src));
 }
 
 /**
  * Copy 128 bytes from one location to another,
  * locations should not overlap.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov128(uint8_t *dst, const uint8_t *src)
 {
     rte_mov64(dst + 0 * 64, src + 0 * 64);
@@ -82,7 +160,7 @@ rte_mov128(uint8_t *dst, const uint8_t *src)
  * Copy 256 bytes from one location to another,
  * locations should not overlap.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov256(uint8_t *dst, const uint8_t *src)
 {
     rte_mov64(dst + 0 * 64, src + 0 * 64);
@@ -94,123 +172,88 @@ rte_mov256(uint8_t *dst, const uint8_t *src)
 /**
  * Copy 128-byte blocks from one location to another,
  * locations should not overlap.
+ * Copies n & ~127 bytes, dst must be 64-byte aligned.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov128blocks(uint8_t *dst, const uint8_t *src, size_t n)
 {
-    while (n >= 128 + 128 * 2)
+    __m512i zmm0, zmm1;
+
+    while (n >= 128)
     {
-        __builtin_prefetch(dst + 256 + 64 * 0, 0, 2);
-        __builtin_prefetch(dst + 256 + 64 * 1, 0, 2);
-        asm volatile("vmovdqa64 %2,%%zmm0\n\t"
-                     "vmovdqa64 %3,%%zmm1\n\t"
-                     "vmovdqa64 %%zmm0,%0\n\t"
-                     "vmovdqa64 %%zmm1,%1\n\t"
-                     "sfence"
-                     : "=m"((dst[0 * 64])), "=m"((dst[1 * 64]))
-                     : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)));
+        __builtin_prefetch(src + 256 + 64 * 0, 0, 2);
+        __builtin_prefetch(src + 256 + 64 * 1, 0, 2);
+        zmm0 = _mm512_loadu_si512(src + 0 * 64);
+        zmm1 = _mm512_loadu_si512(src + 1 * 64);
+        _mm512_store_si512(dst + 0 * 64, zmm0);
+        _mm512_store_si512(dst + 1 * 64, zmm1);
         n -= 128;
         src = src + 128;
         dst = dst + 128;
     }
-    asm volatile("vmovdqa64 %2,%%zmm0\n\t"
-                 "vmovdqa64 %3,%%zmm1\n\t"
-                 "vmovdqa64 %%zmm0,%0\n\t"
-                 "vmovdqa64 %%zmm1,%1\n\t"
-                 "sfence"
-                 : "=m"((dst[0 * 64])), "=m"((dst[1 * 64]))
-                 : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)));
-    n -= 128;
-    src = src + 128;
-    dst = dst + 128;
-
-    asm volatile("vmovdqa64 %2,%%zmm0\n\t"
-                 "vmovdqa64 %3,%%zmm1\n\t"
-                 "vmovdqa64 %%zmm0,%0\n\t"
-                 "vmovdqa64 %%zmm1,%1\n\t"
-                 "sfence"
-                 : "=m"((dst[0 * 64])), "=m"((dst[1 * 64]))
-                 : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)));
-    n -= 128;
-    src = src + 128;
-    dst = dst + 128;
 }
 
 /**
- * Copy 512-byte blocks from one location to another,
+ * Copy 256-byte blocks from one location to another,
  * locations should not overlap.
+ * Copies n & ~255 bytes, dst must be 64-byte aligned.
  */
-static inline void
+TARGET_AVX512 static inline void
 rte_mov256blocks(uint8_t *dst, const uint8_t *src, size_t n)
 {
+    __m512i zmm0, zmm1, zmm2, zmm3;
 
-    while (n >= 256 + 256 * 2)
+    while (n >= 256)
     {
-        __builtin_prefetch(dst + 512 + 64 * 0, 0, 2);
-        __builtin_prefetch(dst + 512 + 64 * 1, 0, 2);
-        __builtin_prefetch(dst + 512 + 64 * 2, 0, 2);
-        __builtin_prefetch(dst + 512 + 64 * 3, 0, 2);
-        asm volatile("vmovdqa64 %4,%%zmm0\n\t"
-                     "vmovdqa64 %5,%%zmm1\n\t"
-                     "vmovdqa64 %6,%%zmm2\n\t"
-                     "vmovdqa64 %7,%%zmm3\n\t"
-
-                     "vmovdqa64 %%zmm0,%0\n\t"
-                     "vmovdqa64 %%zmm1,%1\n\t"
-                     "vmovdqa64 %%zmm2,%2\n\t"
-                     "vmovdqa64 %%zmm3,%3\n\t"
-                     "sfence"
-
-                     : "=m"(dst[0 * 64]), "=m"(dst[1 * 64]),
-                       "=m"(dst[2 * 64]), "=m"(dst[3 * 64])
-                     : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)),
-                       "m"(*(src + 2 * 64)), "m"(*(src + 3 * 64)));
+        __builtin_prefetch(src + 512 + 64 * 0, 0, 2);
+        __builtin_prefetch(src + 512 + 64 * 1, 0, 2);
+        __builtin_prefetch(src + 512 + 64 * 2, 0, 2);
+        __builtin_prefetch(src + 512 + 64 * 3, 0, 2);
+        zmm0 = _mm512_loadu_si512(src + 0 * 64);
+        zmm1 = _mm512_loadu_si512(src + 1 * 64);
+        zmm2 = _mm512_loadu_si512(src + 2 * 64);
+        zmm3 = _mm512_loadu_si512(src + 3 * 64);
+        _mm512_store_si512(dst + 0 * 64, zmm0);
+        _mm512_store_si512(dst + 1 * 64, zmm1);
+        _mm512_store_si512(dst + 2 * 64, zmm2);
+        _mm512_store_si512(dst + 3 * 64, zmm3);
         n -= 256;
         src = src + 256;
         dst = dst + 256;
     }
+}
 
-    asm volatile("vmovdqa64 %4,%%zmm0\n\t"
-                 "vmovdqa64 %5,%%zmm1\n\t"
-                 "vmovdqa64 %6,%%zmm2\n\t"
-                 "vmovdqa64 %7,%%zmm3\n\t"
-
-                 "vmovdqa64 %%zmm0,%0\n\t"
-                 "vmovdqa64 %%zmm1,%1\n\t"
-                 "vmovdqa64 %%zmm2,%2\n\t"
-                 "vmovdqa64 %%zmm3,%3\n\t"
-                 "sfence"
-
-                 : "=m"(dst[0 * 64]), "=m"(dst[1 * 64]),
-                   "=m"(dst[2 * 64]), "=m"(dst[3 * 64])
-                 : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)),
-                   "m"(*(src + 2 * 64)), "m"(*(src + 3 * 64)));
-    n -= 256;
-    src = src + 256;
-    dst = dst + 256;
-
-    asm volatile("vmovdqa64 %4,%%zmm0\n\t"
-                 "vmovdqa64 %5,%%zmm1\n\t"
-                 "vmovdqa64 %6,%%zmm2\n\t"
-                 "vmovdqa64 %7,%%zmm3\n\t"
-
-                 "vmovdqa64 %%zmm0,%0\n\t"
-                 "vmovdqa64 %%zmm1,%1\n\t"
-                 "vmovdqa64 %%zmm2,%2\n\t"
-                 "vmovdqa64 %%zmm3,%3\n\t"
-                 "sfence"
+/**
+ * Copy 256-byte blocks with non-temporal stores, the caller fences.
+ * Copies n & ~255 bytes, dst must be 64-byte aligned.
+ */
+TARGET_AVX512 static inline void
+rte_mov256blocks_nt(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    __m512i zmm0, zmm1, zmm2, zmm3;
 
-                 : "=m"(dst[0 * 64]), "=m"(dst[1 * 64]),
-                   "=m"(dst[2 * 64]), "=m"(dst[3 * 64])
-                 : "m"(*(src + 0 * 64)), "m"(*(src + 1 * 64)),
-                   "m"(*(src + 2 * 64)), "m"(*(src + 3 * 64)));
-    n -= 256;
-    src = src + 256;
-    dst = dst + 256;
+    while (n >= 256)
+    {
+        __builtin_prefetch(src + 512 + 64 * 0, 0, 0);
+        __builtin_prefetch(src + 512 + 64 * 1, 0, 0);
+        __builtin_prefetch(src + 512 + 64 * 2, 0, 0);
+        __builtin_prefetch(src + 512 + 64 * 3, 0, 0);
+        zmm0 = _mm512_loadu_si512(src + 0 * 64);
+        zmm1 = _mm512_loadu_si512(src + 1 * 64);
+        zmm2 = _mm512_loadu_si512(src + 2 * 64);
+        zmm3 = _mm512_loadu_si512(src + 3 * 64);
+        _mm512_stream_si512((__m512i *)(dst + 0 * 64), zmm0);
+        _mm512_stream_si512((__m512i *)(dst + 1 * 64), zmm1);
+        _mm512_stream_si512((__m512i *)(dst + 2 * 64), zmm2);
+        _mm512_stream_si512((__m512i *)(dst + 3 * 64), zmm3);
+        n -= 256;
+        src = src + 256;
+        dst = dst + 256;
+    }
 }
 
-static inline void *
-rte_memcpy_generic(void *dst, const void *src, size_t n)
+TARGET_AVX512 static inline void *
+rte_memcpy_generic(void *dst, const void *src, size_t n, size_t nt_threshold)
 {
     void *ret = dst;
     size_t dstofss;
@@ -285,13 +328,21 @@ rte_memcpy_generic(void *dst, const void *src, size_t n)
     }
 
     /**
-     * Copy 512-byte blocks.
+     * Copy 256-byte blocks.
      * Use copy block function for better instruction order control,
      * which is important when load is unaligned.
+     * Past the threshold the blocks are streamed, the fence orders them
+     * before the temporal stores of the remainder.
      */
-    rte_mov256blocks((uint8_t *)dst, (const uint8_t *)src, n);
+    if (n >= nt_threshold)
+    {
+        rte_mov256blocks_nt((uint8_t *)dst, (const uint8_t *)src, n);
+        _mm_sfence();
+    }
+    else
+        rte_mov256blocks((uint8_t *)dst, (const uint8_t *)src, n);
     bits = n;
-    n = n & 511;
+    n = n & 255;
     bits -= n;
     src = (const uint8_t *)src + bits;
     dst = (uint8_t *)dst + bits;
@@ -317,28 +368,23 @@ rte_memcpy_generic(void *dst, const void *src, size_t n)
     goto COPY_BLOCK_128_BACK63;
 }
 
-static inline void *
+TARGET_AVX512 static inline void *
 rte_memcpy(void *dst, const void *src, size_t n)
 {
-    return rte_memcpy_generic(dst, src, n);
+    return rte_memcpy_generic(dst, src, n, rte_nt_threshold);
 }
 
-static void *allocate(size_t size)
+/**
+ * The two fixed policies rte_memcpy chooses between, for comparison.
+ */
+TARGET_AVX512 static inline void *
+rte_memcpy_temporal(void *dst, const void *src, size_t n)
 {
-    void *ptr = mmap(
-        nullptr,                     // Let OS choose the address
-        size,                        // Size of mapping
-        PROT_READ | PROT_WRITE,      // Read and write permissions
-        MAP_PRIVATE | MAP_ANONYMOUS, // Private mapping, not backed by file
-        -1,                          // File descriptor (not used with MAP_ANONYMOUS)
-        0                            // Offset (not used with MAP_ANONYMOUS)
-    );
-
-    if (ptr == MAP_FAILED)
-    {
-        printf("failed to allocate\n");
-        exit(1);
-    }
+    return rte_memcpy_generic(dst, src, n, SIZE_MAX);
+}
 
-    return ptr;
+TARGET_AVX512 static inline void *
+rte_memcpy_nt(void *dst, const void *src, size_t n)
+{
+    return rte_memcpy_generic(dst, src, n, 0);
 }
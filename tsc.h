@@ -0,0 +1,64 @@
+#include <x86intrin.h>
+
+static double tsc_per_ns = 1.0;   // filled by tsc_calibrate()
+static uint64_t tsc_overhead = 0; // cycles of an empty tsc_begin/tsc_end pair
+
+/**
+ * Read the TSC before the timed region. The lfence keeps earlier
+ * instructions from drifting into the measurement.
+ */
+static inline uint64_t tsc_begin(void)
+{
+    _mm_lfence();
+    return __rdtsc();
+}
+
+/**
+ * Read the TSC after the timed region. rdtscp waits for the region to
+ * retire, the lfence keeps later instructions out of it.
+ */
+static inline uint64_t tsc_end(void)
+{
+    unsigned int aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+
+static inline uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint64_t)(cycles / tsc_per_ns);
+}
+
+/**
+ * Measure the TSC rate against CLOCK_MONOTONIC and the cost of the timing
+ * fences themselves. Warns when the cpu does not advertise an invariant TSC,
+ * in which case cycle counts drift with frequency changes.
+ */
+static void tsc_calibrate(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    struct timespec t0, t1, sleep = {0, 100000000};
+    uint64_t c0, c1;
+
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+        printf("TSC is not invariant, latencies may be skewed by frequency changes\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = tsc_begin();
+    nanosleep(&sleep, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = tsc_end();
+    tsc_per_ns = (double)(c1 - c0) /
+                 ((t1.tv_sec - t0.tv_sec) * 1000000000.0 + (t1.tv_nsec - t0.tv_nsec));
+
+    tsc_overhead = ~0ULL;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t a = tsc_begin();
+        uint64_t b = tsc_end();
+        tsc_overhead = std::min(tsc_overhead, (uint64_t)(b - a));
+    }
+
+    printf("TSC %.3f GHz, timer overhead %lu cycles\n", tsc_per_ns, (unsigned long)tsc_overhead);
+}
@@ -0,0 +1,94 @@
+typedef size_t (*mismatch_func_t)(const void *a, const void *b, size_t n);
+
+/**
+ * Offset of the first byte that differs between a and b, or n if the
+ * ranges are equal.
+ */
+static size_t find_mismatch_scalar(const void *a, const void *b, size_t n)
+{
+    const uint8_t *pa = (const uint8_t *)a;
+    const uint8_t *pb = (const uint8_t *)b;
+    size_t off = 0;
+
+    // libc memcmp is vectorized, only walk bytes inside a differing block
+    for (; off + 4096 <= n; off += 4096)
+    {
+        if (memcmp(pa + off, pb + off, 4096) != 0)
+            break;
+    }
+    for (; off < n; off++)
+    {
+        if (pa[off] != pb[off])
+            return off;
+    }
+    return n;
+}
+
+TARGET_AVX2 static size_t find_mismatch_avx2(const void *a, const void *b, size_t n)
+{
+    const uint8_t *pa = (const uint8_t *)a;
+    const uint8_t *pb = (const uint8_t *)b;
+    size_t off = 0;
+
+    for (; off + 128 <= n; off += 128)
+    {
+        __m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pa + off) + 0),
+                                       _mm256_loadu_si256((const __m256i *)(pb + off) + 0));
+        __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pa + off) + 1),
+                                       _mm256_loadu_si256((const __m256i *)(pb + off) + 1));
+        __m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pa + off) + 2),
+                                       _mm256_loadu_si256((const __m256i *)(pb + off) + 2));
+        __m256i e3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pa + off) + 3),
+                                       _mm256_loadu_si256((const __m256i *)(pb + off) + 3));
+        __m256i all = _mm256_and_si256(_mm256_and_si256(e0, e1), _mm256_and_si256(e2, e3));
+
+        if ((unsigned int)_mm256_movemask_epi8(all) != 0xffffffffu)
+            break;
+    }
+    for (; off + 32 <= n; off += 32)
+    {
+        unsigned int eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pa + off)),
+                                                                 _mm256_loadu_si256((const __m256i *)(pb + off))));
+        if (eq != 0xffffffffu)
+            return off + __builtin_ctz(~eq);
+    }
+    return off + find_mismatch_scalar(pa + off, pb + off, n - off);
+}
+
+TARGET_AVX512 static size_t find_mismatch_avx512(const void *a, const void *b, size_t n)
+{
+    const uint8_t *pa = (const uint8_t *)a;
+    const uint8_t *pb = (const uint8_t *)b;
+    size_t off = 0;
+
+    for (; off + 256 <= n; off += 256)
+    {
+        __mmask64 m0 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(pa + off + 0 * 64), _mm512_loadu_si512(pb + off + 0 * 64));
+        __mmask64 m1 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(pa + off + 1 * 64), _mm512_loadu_si512(pb + off + 1 * 64));
+        __mmask64 m2 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(pa + off + 2 * 64), _mm512_loadu_si512(pb + off + 2 * 64));
+        __mmask64 m3 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(pa + off + 3 * 64), _mm512_loadu_si512(pb + off + 3 * 64));
+
+        if (m0 | m1 | m2 | m3)
+            break;
+    }
+    for (; off < n; off += 64)
+    {
+        size_t len = std::min((size_t)64, n - off);
+        __mmask64 valid = len == 64 ? ~0ULL : (1ULL << len) - 1;
+        __mmask64 ne = _mm512_mask_cmpneq_epi8_mask(valid, _mm512_maskz_loadu_epi8(valid, pa + off),
+                                                    _mm512_maskz_loadu_epi8(valid, pb + off));
+        if (ne)
+            return off + __builtin_ctzll(ne);
+    }
+    return n;
+}
+
+static mismatch_func_t find_mismatch = find_mismatch_scalar;
+
+static void verify_init(void)
+{
+    if (cpu_features.avx512bw)
+        find_mismatch = find_mismatch_avx512;
+    else if (cpu_features.avx2)
+        find_mismatch = find_mismatch_avx2;
+}